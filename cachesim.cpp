@@ -1,1464 +1,2503 @@
 #include "cachesim.hpp"
+#include <cmath>
+
+// Replacement policy traits for the generic access path. Each policy says
+// how to pick a victim, how to update a block on a demand fill or a hit,
+// and how to place a prefetched block. The two policies also differ in two
+// quirks of the reference simulator, kept here so results stay identical:
+// - whether the L2 prefetch happens before or after the write-back of a
+//   dirty L1 victim
+// - whether an L1 miss with L2 disabled still counts as an L2 read miss
+struct LRUPolicy
+{
+    static const bool prefetch_before_writeback = false;
+    static const bool counts_l2_when_disabled = true;
+
+    static uint64_t victim(cache_t *cache, uint64_t set_index)
+    {
+        return findLRUBlockIndex(cache, set_index, cache->num_ways);
+    }
+    static void fill(cache_t *cache, uint64_t set_index, uint64_t block_index)
+    {
+        moveToMRU(cache, set_index, block_index);
+    }
+    static void hit(cache_t *cache, uint64_t set_index, uint64_t block_index)
+    {
+        moveToMRU(cache, set_index, block_index);
+    }
+    static void prefetchFill(cache_t *cache, uint64_t set_index, uint64_t block_index, insert_policy_t insert)
+    {
+        if (insert == INSERT_POLICY_LIP)
+        {
+            insertAtLRU(cache, set_index, block_index);
+        }
+        else
+        {
+            moveToMRU(cache, set_index, block_index);
+        }
+    }
+};
+
+struct LFUPolicy
+{
+    static const bool prefetch_before_writeback = true;
+    static const bool counts_l2_when_disabled = false;
+
+    static uint64_t victim(cache_t *cache, uint64_t set_index)
+    {
+        return findLFUBlockIndex(cache, set_index, cache->num_ways);
+    }
+    static void fill(cache_t *cache, uint64_t set_index, uint64_t block_index)
+    {
+        setMRUBitNewAndClearOther(cache, set_index, block_index);
+        setFrequency(cache, set_index, block_index, 1);
+    }
+    static void hit(cache_t *cache, uint64_t set_index, uint64_t block_index)
+    {
+        setMRUBitNewAndClearOther(cache, set_index, block_index);
+        incrementFrequency(cache, set_index, block_index);
+    }
+    // Prefetched blocks start with no uses; with LIP they don't take the MRU
+    // slot either
+    static void prefetchFill(cache_t *cache, uint64_t set_index, uint64_t block_index, insert_policy_t insert)
+    {
+        if (insert == INSERT_POLICY_LIP)
+        {
+            clearMRUBit(cache, set_index, block_index);
+        }
+        else
+        {
+            setMRUBitNewAndClearOther(cache, set_index, block_index);
+        }
+        setFrequency(cache, set_index, block_index, 0);
+    }
+};
+
+// Set sampling: at most 2^SAMPLE_GROUP_BITS_MAX set groups, chosen by a
+// multiplicative hash whose top SAMPLE_HASH_BITS are compared to the rate
+static const uint64_t SAMPLE_GROUP_BITS_MAX = 16;
+static const uint64_t SAMPLE_HASH_BITS = 24;
+static const uint64_t SAMPLE_HASH_MUL = 0x9E3779B97F4A7C15ULL;
+// Two-sided 95% normal quantile
+static const double SAMPLE_Z95 = 1.96;
+
+Simulator::Simulator()
+    : access_impl(NULL), batch_impl(NULL), L1(NULL), L2(NULL), L1I(NULL), write_buffer_head(0),
+      write_buffer_count(0), num_levels(0),
+      sampling(false), sample_bits(0), sample_threshold(0), seen_reads(0), seen_writes(0),
+      sample_groups(NULL), windowing(false), warm_impl(NULL), checkpoint_map(NULL), checkpoint_bytes(0)
+{
+    memset(&stats, 0, sizeof stats);
+    memset(&sample_stats, 0, sizeof sample_stats);
+    memset(&window_stats, 0, sizeof window_stats);
+    memset(&victims, 0, sizeof victims);
+}
 
-cache *L1;
-cache *L2;
+Simulator::~Simulator()
+{
+    freeCaches();
+}
 
-uint64_t prev_block_addr = 0x0;
+// Number of cache levels config simulates
+static uint64_t levelsOf(const sim_config_t *config)
+{
+    return config->l2_config.disabled ? 1 : 2 + std::min(config->num_outer_levels, SIM_MAX_LEVELS - 2);
+}
 
 /**
  * Subroutine for initializing the cache simulator. You many add and initialize any global or heap
  * variables as needed.
  * TODO: You're responsible for completing this routine
  */
-
-void sim_setup(sim_config_t *config)
+void Simulator::setup(const sim_config_t *config)
 {
+    freeCaches();
+
     L1 = (cache *)malloc(sizeof(cache));
     L2 = (cache *)malloc(sizeof(cache));
 
-    L1->config = config->l1_config;
-    L2->config = config->l2_config;
+    initCache(L1, &config->l1_config);
+    initCache(L2, &config->l2_config);
+    if (!config->l1i_config.disabled)
+    {
+        L1I = (cache *)malloc(sizeof(cache));
+        initCache(L1I, &config->l1i_config);
+    }
+    if (config->victim_entries)
+    {
+        initVictimCache(&victims, config->victim_entries, config->l1_config.b);
+    }
+    num_levels = levelsOf(config);
+    for (uint64_t level = 2; level < num_levels; level++)
+    {
+        outer[level - 2] = (cache *)malloc(sizeof(cache));
+        initCache(outer[level - 2], &config->outer_configs[level - 2]);
+    }
+
+    configure(config);
+    if (sampling)
+    {
+        sample_groups = (sample_group *)calloc(1UL << sample_bits, sizeof(sample_group));
+    }
+}
+
+static bool sameCacheConfig(const cache_config_t *a, const cache_config_t *b)
+{
+    return a->disabled == b->disabled && a->prefetcher_disabled == b->prefetcher_disabled &&
+           a->strided_prefetch_disabled == b->strided_prefetch_disabled &&
+           a->c == b->c && a->b == b->b && a->s == b->s && a->replace_policy == b->replace_policy &&
+           a->prefetch_insert_policy == b->prefetch_insert_policy && a->write_strat == b->write_strat &&
+           a->inclusion == b->inclusion && a->prefetch_kind == b->prefetch_kind &&
+           a->prefetch_degree == b->prefetch_degree && a->prefetch_distance == b->prefetch_distance;
+}
+
+// Snapshot for what-if runs: the tag stores are flat arrays, so a copy is
+// one allocation and memcpy per cache. Only the L2 prefetch settings may
+// change, since they select the access routine but not the state layout.
+int Simulator::clone_from(const Simulator &other, const sim_config_t *config)
+{
+    if (other.L1 == NULL)
+    {
+        printf("ERROR: no simulation to clone\n");
+        return 1;
+    }
+    sim_config_t next = other.config;
+    if (config != NULL)
+    {
+        next.l2_config.prefetcher_disabled = config->l2_config.prefetcher_disabled;
+        next.l2_config.strided_prefetch_disabled = config->l2_config.strided_prefetch_disabled;
+        next.l2_config.prefetch_insert_policy = config->l2_config.prefetch_insert_policy;
+        next.l2_config.prefetch_kind = config->l2_config.prefetch_kind;
+        bool same_levels = levelsOf(&next) == levelsOf(config);
+        for (uint64_t level = 2; same_levels && level < levelsOf(config); level++)
+        {
+            same_levels = sameCacheConfig(&next.outer_configs[level - 2], &config->outer_configs[level - 2]);
+        }
+        if (!same_levels || !sameCacheConfig(&next.l1_config, &config->l1_config) ||
+            !sameCacheConfig(&next.l2_config, &config->l2_config) ||
+            !sameCacheConfig(&next.l1i_config, &config->l1i_config) ||
+            next.victim_entries != config->victim_entries ||
+            next.write_buffer_depth != config->write_buffer_depth || next.prefetch_stats != config->prefetch_stats ||
+            next.sample_rate != config->sample_rate || next.window_period != config->window_period ||
+            next.window_warmup != config->window_warmup || next.window_length != config->window_length)
+        {
+            printf("ERROR: a clone may only change the L2 prefetcher and insertion policy\n");
+            return 1;
+        }
+    }
+
+    freeCaches();
+    L1 = (cache *)malloc(sizeof(cache));
+    L2 = (cache *)malloc(sizeof(cache));
+    copyCache(L1, other.L1, &next.l1_config);
+    copyCache(L2, other.L2, &next.l2_config);
+    if (other.L1I != NULL)
+    {
+        L1I = (cache *)malloc(sizeof(cache));
+        copyCache(L1I, other.L1I, &next.l1i_config);
+    }
+    if (other.victims.num_entries)
+    {
+        copyVictimCache(&victims, &other.victims);
+    }
+    for (uint64_t level = 2; level < other.num_levels; level++)
+    {
+        outer[level - 2] = (cache *)malloc(sizeof(cache));
+        copyCache(outer[level - 2], other.outer[level - 2], &next.outer_configs[level - 2]);
+    }
+    configure(&next);
+    if (sampling)
+    {
+        size_t bytes = (1UL << sample_bits) * sizeof(sample_group);
+        sample_groups = (sample_group *)malloc(bytes);
+        memcpy(sample_groups, other.sample_groups, bytes);
+    }
 
-    L1->timestamp_counter = 1UL << (config->l1_config.c - config->l1_config.b + 1);
-    L2->timestamp_counter = 1UL << (config->l2_config.c - config->l2_config.b + 1);
-    // L1->timestamp_counter = 0;
-    // L2->timestamp_counter = 0;
+    memcpy(prefetchers, other.prefetchers, sizeof prefetchers);
+    memcpy(write_buffer, other.write_buffer, sizeof write_buffer);
+    write_buffer_head = other.write_buffer_head;
+    write_buffer_count = other.write_buffer_count;
+    memcpy(outer_stats, other.outer_stats, sizeof outer_stats);
+    stats = other.stats;
+    seen_reads = other.seen_reads;
+    seen_writes = other.seen_writes;
+    window_pos = other.window_pos;
+    window_start = other.window_start;
+    measured = other.measured;
+    window_hit_ratio_l1 = other.window_hit_ratio_l1;
+    window_read_hit_ratio_l2 = other.window_read_hit_ratio_l2;
+    window_avg_access_time_l1 = other.window_avg_access_time_l1;
+    window_stats = other.window_stats;
+    return 0;
+}
 
-    // Calculate the number of sets for L1 and L2
-    uint64_t num_sets_L1 = 1UL << (L1->config.c - L1->config.b - L1->config.s);
-    uint64_t num_sets_L2 = 1UL << (L2->config.c - L2->config.b - L2->config.s);
+// The cache and prefetcher state are kept, as is the position in the
+// time-sampling schedule
+void Simulator::reset_stats()
+{
+    memset(&stats, 0, sizeof stats);
+    seen_reads = 0;
+    seen_writes = 0;
+    if (sampling)
+    {
+        memset(sample_groups, 0, (1UL << sample_bits) * sizeof(sample_group));
+    }
+    window_start = stats;
+    memset(&measured, 0, sizeof measured);
+    memset(&window_hit_ratio_l1, 0, sizeof window_hit_ratio_l1);
+    memset(&window_read_hit_ratio_l2, 0, sizeof window_read_hit_ratio_l2);
+    memset(&window_avg_access_time_l1, 0, sizeof window_avg_access_time_l1);
+    memset(&window_stats, 0, sizeof window_stats);
+}
 
-    // Allocate sets for L1
-    L1->sets = (set *)malloc(num_sets_L1 * sizeof(set));
-    for (uint64_t i = 0; i < num_sets_L1; ++i)
+// Reset the run state for config and pick the access routines. The caches
+// must be set up already; the sample groups are left to the caller.
+void Simulator::configure(const sim_config_t *config)
+{
+    this->config = *config;
+    memset(&stats, 0, sizeof stats);
+    for (uint64_t level = 0; level < SIM_MAX_LEVELS - 1; level++)
+    {
+        initPrefetcher(&prefetchers[level]);
+    }
+    write_buffer_head = 0;
+    write_buffer_count = 0;
+    num_levels = levelsOf(config);
+    memset(outer_stats, 0, sizeof outer_stats);
+
+    // Set sampling (as in SHARDS) simulates only the accesses that fall in
+    // a hashed subset of the set groups and scales the counts back up. A
+    // group is the low index bits common to L1 and L2, so a sampled group
+    // owns whole sets of both caches. A cache with a single set leaves
+    // nothing to sample and the run stays exact.
+    uint64_t index_bits = L1->config.c - L1->config.b - L1->config.s;
+    if (!L2->config.disabled)
+    {
+        index_bits = std::min(index_bits, L2->config.c - L2->config.b - L2->config.s);
+    }
+    sample_bits = std::min(index_bits, SAMPLE_GROUP_BITS_MAX);
+    sampling = config->sample_rate < 1.0 && sample_bits > 0 && num_levels <= 2 && L1I == NULL && victims.num_entries == 0;
+    seen_reads = 0;
+    seen_writes = 0;
+    memset(&sample_stats, 0, sizeof sample_stats);
+    if (sampling)
     {
-        L1->sets[i].blocks = (block *)malloc(sizeof(block) * (1UL << (L1->config.s)));
-        memset(L1->sets[i].blocks, 0, sizeof(block) * (1UL << (L1->config.s)));
+        sample_threshold = std::max((uint64_t)1, (uint64_t)(config->sample_rate * (1UL << SAMPLE_HASH_BITS)));
     }
 
-    // Allocate sets for L2
-    L2->sets = (set *)malloc(num_sets_L2 * sizeof(set));
-    for (uint64_t i = 0; i < num_sets_L2; ++i)
+    // Time sampling (as in SMARTS), see windowedBatch()
+    windowing = config->window_length > 0 && num_levels <= 2 && L1I == NULL && victims.num_entries == 0;
+    window_period = config->window_period;
+    window_warmup = config->window_warmup;
+    window_length = config->window_length;
+    window_pos = 0;
+    memset(&measured, 0, sizeof measured);
+    memset(&window_hit_ratio_l1, 0, sizeof window_hit_ratio_l1);
+    memset(&window_read_hit_ratio_l2, 0, sizeof window_read_hit_ratio_l2);
+    memset(&window_avg_access_time_l1, 0, sizeof window_avg_access_time_l1);
+    memset(&window_stats, 0, sizeof window_stats);
+
+    if (L1->config.replace_policy == REPLACE_POLICY_LFU)
+    {
+        selectAccess<LFUPolicy>();
+    }
+    else
     {
-        L2->sets[i].blocks = (block *)malloc(sizeof(block) * (1UL << (L2->config.s)));
-        memset(L2->sets[i].blocks, 0, sizeof(block) * (1UL << (L2->config.s)));
+        selectAccess<LRUPolicy>();
     }
 }
 
+// Cache geometry for the access path. RuntimeGeometry works for any
+// (C,B,S) by reading the cache config; FixedGeometry bakes one (C,B,S) in
+// so shifts, masks and the way count are constants and the tag compare
+// unrolls. selectAccess() uses a fixed instance when the configuration
+// matches one listed there.
+struct RuntimeGeometry
+{
+    static bool matches(const cache_t *cache)
+    {
+        return true;
+    }
+    static uint64_t ways(const cache_t *cache)
+    {
+        return cache->num_ways;
+    }
+    static uint64_t index(const cache_t *cache, uint64_t addr)
+    {
+        return getIndex(addr, (cache_t *)cache);
+    }
+    static uint64_t tag(const cache_t *cache, uint64_t addr)
+    {
+        return getTag(addr, (cache_t *)cache);
+    }
+    static uint64_t blockAddr(const cache_t *cache, uint64_t addr)
+    {
+        return blockAddrTrans((cache_t *)cache, addr);
+    }
+    // Address of the block with this tag in this set
+    static uint64_t addrOf(const cache_t *cache, uint64_t tag, uint64_t set_index)
+    {
+        return (tag << (cache->config.c - cache->config.s)) + (set_index << cache->config.b);
+    }
+    static uint64_t lookup(cache_t *cache, uint64_t set_index, uint64_t tag)
+    {
+        return findValidBlockIndex(cache, set_index, tag);
+    }
+};
+
+template <uint64_t C, uint64_t B, uint64_t S>
+struct FixedGeometry
+{
+    static_assert(S <= 6, "fixed geometries keep a set's flags in one word");
+    static const uint64_t WAYS = 1UL << S;
+    static const uint64_t INDEX_MASK = (1UL << (C - B - S)) - 1;
+
+    static bool matches(const cache_t *cache)
+    {
+        return cache->config.c == C && cache->config.b == B && cache->config.s == S;
+    }
+    static uint64_t ways(const cache_t *cache)
+    {
+        return WAYS;
+    }
+    static uint64_t index(const cache_t *cache, uint64_t addr)
+    {
+        return (addr >> B) & INDEX_MASK;
+    }
+    static uint64_t tag(const cache_t *cache, uint64_t addr)
+    {
+        return addr >> (C - S);
+    }
+    static uint64_t blockAddr(const cache_t *cache, uint64_t addr)
+    {
+        return addr & ~((1UL << B) - 1);
+    }
+    static uint64_t addrOf(const cache_t *cache, uint64_t tag, uint64_t set_index)
+    {
+        return (tag << (C - S)) + (set_index << B);
+    }
+    static uint64_t lookup(cache_t *cache, uint64_t set_index, uint64_t tag)
+    {
+        const uint64_t *tags = &cache->tags[set_index * WAYS];
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < WAYS; i++)
+        {
+            hits |= (uint64_t)(tags[i] == tag) << i;
+        }
+        hits &= cache->valid_bits[set_index];
+        return hits ? __builtin_ctzll(hits) : UINT64_MAX;
+    }
+};
+
+// DEFAULT_SIM_CONFIG: 1KB 2-way L1, 32KB 8-way L2
+typedef FixedGeometry<10, 6, 1> DefaultL1Geometry;
+typedef FixedGeometry<15, 6, 3> DefaultL2Geometry;
+// L1-only configs of validate_grad.sh
+typedef FixedGeometry<10, 6, 0> DirectMappedL1Geometry;
+typedef FixedGeometry<14, 6, 4> SetAssocL1Geometry;
+typedef FixedGeometry<10, 6, 4> FullyAssocL1Geometry;
+
 /**
  * Subroutine that simulates the cache one trace event at a time.
  * TODO: You're responsible for completing this routine
  */
-void sim_access(char rw, uint64_t addr, sim_stats_t *stats)
+void Simulator::access(char rw, uint64_t addr)
 {
-    uint64_t tag = getTag(addr, L1);
-    uint64_t index = getIndex(addr, L1);
-    uint64_t num_blocks = 1UL << (L1->config.s);
-    uint64_t l1_target = isInCache(rw, addr, stats, L1);
-
-#ifdef DEBUG
-    printf("Time: %d Address: 0x%lx Read/Write: %c \n", L1->timestamp_counter, addr, rw);
-    printf("L1 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx \n", addr, tag, index);
-#endif
+    if (windowing)
+    {
+        uint8_t rw_byte = rw;
+        windowedBatch(&addr, &rw_byte, 1);
+        return;
+    }
+    if (sampling)
+    {
+        sampledAccess(rw, addr);
+        return;
+    }
+    (this->*access_impl)(rw, addr);
+}
 
-    if (L1->config.replace_policy == REPLACE_POLICY_LRU && L2->config.replace_policy == REPLACE_POLICY_LRU)
+// Run n accesses (rws[i] is 'R', 'W' or 'I') in one call. Same results as n
+// calls to access(), with less per-access overhead.
+void Simulator::access_batch(const uint64_t *addrs, const uint8_t *rws, size_t n)
+{
+    if (windowing)
+    {
+        windowedBatch(addrs, rws, n);
+        return;
+    }
+    if (sampling)
     {
-        if (l1_target == UINT64_MAX)
+        for (size_t i = 0; i < n; i++)
         {
-#ifdef DEBUG
-            printf("L1 miss\n");
-#endif
-            // L1 Write miss
-            if (rw == 'W')
-            {
-                // make sure whether cache set is full
-                uint64_t empty_block = findEmptyBlockIndex(L1, index, num_blocks);
-                // Still have empty blocks
-                if (empty_block != UINT64_MAX)
-                {
-                    // When L2 is disabled
-                    if (L2->config.disabled)
-                    {
-                        setTag(L1, index, empty_block, tag);
-                        setValidBit(L1, index, empty_block);
-                        setDirtyBit(L1, index, empty_block);
-                        updateTimestamp(L1, index, empty_block);
-                        stats->reads_l2++;
-                        stats->read_misses_l2++;
-                    }
-                    else // When L2 is enabled
-                    {
-                        uint64_t l2_tag = getTag(addr, L2);
-                        uint64_t l2_index = getIndex(addr, L2);
-                        uint64_t l2_num_blocks = 1UL << (L2->config.s);
+            sampledAccess(rws[i], addrs[i]);
+        }
+        return;
+    }
+    (this->*batch_impl)(addrs, rws, n);
+}
 
-#ifdef DEBUG
-                        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx\n", addr, l2_tag, l2_index);
-#endif
+// Simulate the access if its set group is sampled, charging what it did to
+// the group
+void Simulator::sampledAccess(char rw, uint64_t addr)
+{
+    if (rw == WRITE)
+    {
+        seen_writes++;
+    }
+    else
+    {
+        seen_reads++;
+    }
 
-                        uint64_t l2_target = isInCache('R', addr, stats, L2);
-                        // When the needed block is not in L2
-                        // It needs to select a block to put needed
-                        // block in at first
-                        // L2 miss
-                        if (l2_target == UINT64_MAX)
-                        {
-#ifdef DEBUG
-                            printf("L2 read miss\n");
-#endif
-                            uint64_t l2_empty_block = findEmptyBlockIndex(L2, l2_index, l2_num_blocks);
-                            // Still empty block in L2
-                            if (l2_empty_block != UINT64_MAX)
-                            {
-                                setTag(L2, l2_index, l2_empty_block, l2_tag);
-                                setValidBit(L2, l2_index, l2_empty_block);
-                                updateTimestamp(L2, l2_index, l2_empty_block);
-                            }
-                            else
-                            {
-                                // LRU
-                                uint64_t l2_lru_index = findLRUBlockIndex(&(L2->sets[l2_index]), l2_num_blocks);
-                                // Whether this LRU is dirty?
-
-                                setTag(L2, l2_index, l2_lru_index, l2_tag);
-                                updateTimestamp(L2, l2_index, l2_lru_index);
+    uint64_t group = (addr >> L1->config.b) & ((1UL << sample_bits) - 1);
+    if (((group * SAMPLE_HASH_MUL) >> (64 - SAMPLE_HASH_BITS)) >= sample_threshold)
+    {
+        return;
+    }
 
-#ifdef DEBUG
-                                printf("Evict from L2: block with valid=%d and index=0x%lx\n", 0, l2_index);
-#endif
-                            }
-                            // deal with prefetch
-                            prefetch(L2, addr, stats);
-                        }
-                        else // When the needed block is in L2
-                        {
-                            updateTimestamp(L2, l2_index, l2_target);
+    uint64_t misses_l1 = stats.misses_l1;
+    uint64_t reads_l2 = stats.reads_l2;
+    uint64_t read_misses_l2 = stats.read_misses_l2;
+    (this->*access_impl)(rw, addr);
 
-#ifdef DEBUG
-                            printf("L2 read hit");
-#endif
-                        }
-                        // Then Add the needed block to L1
-                        setTag(L1, index, empty_block, tag);
-                        setValidBit(L1, index, empty_block);
-                        setDirtyBit(L1, index, empty_block);
-                        updateTimestamp(L1, index, empty_block);
-                    }
-                }
-                else // L1 is full set of blocks and eviction is needed
-                {
-                    // LRU
-                    uint64_t lru_index = findLRUBlockIndex(&(L1->sets[index]), num_blocks);
-
-                    if (L2->config.disabled)
-                    {
-                        // Whether this LRU is dirty?
-                        if (getDirtyBit(L1, index, lru_index))
-                        {
-                            setTag(L1, index, lru_index, tag);
-                            setDirtyBit(L1, index, lru_index);
-                            updateTimestamp(L1, index, lru_index);
-                            stats->reads_l2++;
-                            stats->read_misses_l2++;
-                            stats->writes_l2++;
-                        }
-                        else
-                        {
-                            setTag(L1, index, lru_index, tag);
-                            setDirtyBit(L1, index, lru_index);
-                            updateTimestamp(L1, index, lru_index);
-                            stats->reads_l2++;
-                            stats->read_misses_l2++;
-                        }
-                    }
-                    else
-                    {
-                        uint64_t l2_tag = getTag(addr, L2);
-                        uint64_t l2_index = getIndex(addr, L2);
-                        uint64_t l2_num_blocks = 1UL << (L2->config.s);
-#ifdef DEBUG
-                        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx \n", addr, l2_tag, l2_index);
-#endif
-                        uint64_t l2_target = isInCache('R', addr, stats, L2);
-                        // When the needed block is not in L2
-                        // It needs to select a block to put needed
-                        // block in at first
-                        // L2 miss
-                        if (l2_target == UINT64_MAX)
-                        {
-#ifdef DEBUG
-                            printf("L2 read miss\n");
-#endif
-                            uint64_t l2_empty_block = findEmptyBlockIndex(L2, l2_index, l2_num_blocks);
-                            // Still empty block in L2
-                            if (l2_empty_block != UINT64_MAX)
-                            {
-                                setTag(L2, l2_index, l2_empty_block, l2_tag);
-                                setValidBit(L2, l2_index, l2_empty_block);
-                                updateTimestamp(L2, l2_index, l2_empty_block);
-                            }
-                            else
-                            {
-                                // LRU
-                                uint64_t l2_lru_index = findLRUBlockIndex(&(L2->sets[l2_index]), l2_num_blocks);
-
-                                setTag(L2, l2_index, l2_lru_index, l2_tag);
-                                updateTimestamp(L2, l2_index, l2_lru_index);
-                                // deal with prefetch
+    sample_group *g = &sample_groups[group];
+    g->accesses_l1++;
+    g->misses_l1 += stats.misses_l1 - misses_l1;
+    g->reads_l2 += stats.reads_l2 - reads_l2;
+    g->read_misses_l2 += stats.read_misses_l2 - read_misses_l2;
+}
 
-#ifdef DEBUG
-                                printf("Evicted from L2: block with valid: %d index: 0x%lx\n",
-                                       0,
-                                       l2_index);
-#endif
-                            }
-                            /* prefetch(L2, addr, stats);
-                            prev_block_addr = blockAddrTrans(L2, addr); */
-                        }
-                        else // When the needed block is in L2
-                        {
-                            updateTimestamp(L2, l2_index, l2_target);
-#ifdef DEBUG
-                            printf("L2 read hit\n");
-#endif
-                        }
-                        // Then Add the needed block to L1
-                        // While deal with the evicted
-                        // While the dirtybit is set,
-                        // the block needs to be write in L2
-                        if (getDirtyBit(L1, index, lru_index))
-                        {
-                            uint64_t evicted_tag = L1->sets[index].blocks[lru_index].tag;
-                            uint64_t l1_index_bits = (L1->config.c - L1->config.s - L1->config.b);
-                            uint64_t l1_offset_bits = (L1->config.b);
-                            uint64_t addr = (evicted_tag << (l1_index_bits + l1_offset_bits)) + (index << L1->config.b);
-                            uint64_t l2_tag = getTag(addr, L2);
-                            uint64_t l2_index = getIndex(addr, L2);
-                            uint64_t evicted_target_block = isInCache('W', addr, stats, L2);
-
-                            // Not in L2
-                            if (evicted_target_block == UINT64_MAX)
-                            {
-                            }
-                            else
-                            {
-                                updateTimestamp(L2, l2_index, evicted_target_block);
-                            }
-                        }
-                        setTag(L1, index, lru_index, tag);
-                        setDirtyBit(L1, index, lru_index);
-                        updateTimestamp(L1, index, lru_index);
-
-                        if (l2_target == UINT64_MAX)
-                        {
-                            prefetch(L2, addr, stats);
-                        }
-                    }
-#ifdef DEBUG
-                    printf("Evict from L1: block with valid=%d, dirty=%d, tag 0x%lx and index=0x%lx\n",
-                           L1->sets[index].blocks[lru_index].valid_bit,
-                           L1->sets[index].blocks[lru_index].dirty_bit,
-                           tag,
-                           index);
-#endif
-                }
-            }
+// Time sampling splits the trace into periods of window_period accesses.
+// Each period starts with a fast-forward, which only keeps the tags and
+// replacement state current (see warmWith()), followed by window_warmup
+// accesses simulated in detail but not measured and window_length
+// accesses that are measured. Set sampling is not applied.
+void Simulator::windowedBatch(const uint64_t *addrs, const uint8_t *rws, size_t n)
+{
+    uint64_t fast_forward = window_period - window_warmup - window_length;
+    uint64_t measure = fast_forward + window_warmup;
+    window_stats.accesses += n;
+    while (n > 0)
+    {
+        uint64_t end;
+        if (window_pos < fast_forward)
+        {
+            end = fast_forward;
+        }
+        else if (window_pos < measure)
+        {
+            end = measure;
+        }
+        else
+        {
+            end = window_period;
+        }
+        size_t m = std::min((uint64_t)n, end - window_pos);
 
-            // Read miss
-            if (rw == 'R')
-            {
-                // make sure whether cache set is full
-                uint64_t empty_block = findEmptyBlockIndex(L1, index, num_blocks);
-                if (empty_block != UINT64_MAX)
-                {
-
-                    if (L2->config.disabled)
-                    {
-                        setTag(L1, index, empty_block, tag);
-                        setValidBit(L1, index, empty_block);
-                        updateTimestamp(L1, index, empty_block);
-                        stats->reads_l2++;
-                        stats->read_misses_l2++;
-                    }
-                    else
-                    {
-                        uint64_t l2_tag = getTag(addr, L2);
-                        uint64_t l2_index = getIndex(addr, L2);
-                        uint64_t l2_num_blocks = 1UL << (L2->config.s);
-#ifdef DEBUG
-                        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx\n", addr, l2_tag, l2_index);
-#endif
+        if (window_pos == measure)
+        {
+            window_start = stats;
+        }
+        if (window_pos < fast_forward)
+        {
+            (this->*warm_impl)(addrs, rws, m);
+        }
+        else
+        {
+            (this->*batch_impl)(addrs, rws, m);
+        }
 
-                        uint64_t l2_target = isInCache('R', addr, stats, L2);
-                        // When the needed block is not in L2
-                        // It needs to select a block to put needed
-                        // block in at first
-                        if (l2_target == UINT64_MAX)
-                        {
-#ifdef DEBUG
-                            printf("L2 read miss\n");
-#endif
+        window_pos += m;
+        addrs += m;
+        rws += m;
+        n -= m;
+        if (window_pos == window_period)
+        {
+            closeWindow();
+            window_pos = 0;
+        }
+    }
+}
 
-                            uint64_t l2_empty_block = findEmptyBlockIndex(L2, l2_index, l2_num_blocks);
-                            // Still have empty block in L2
-                            if (l2_empty_block != UINT64_MAX)
-                            {
-                                setTag(L2, l2_index, l2_empty_block, l2_tag);
-                                setValidBit(L2, l2_index, l2_empty_block);
-                                updateTimestamp(L2, l2_index, l2_empty_block);
-                            }
-                            else
-                            {
-                                // LRU
-                                uint64_t l2_lru_index = findLRUBlockIndex(&(L2->sets[l2_index]), l2_num_blocks);
-
-                                setTag(L2, l2_index, l2_lru_index, l2_tag);
-                                updateTimestamp(L2, l2_index, l2_lru_index);
+// Add the counters of a - b to sum
+static void addCounterDelta(sim_stats_t *sum, const sim_stats_t *a, const sim_stats_t *b)
+{
+    sum->reads += a->reads - b->reads;
+    sum->writes += a->writes - b->writes;
+    sum->accesses_l1 += a->accesses_l1 - b->accesses_l1;
+    sum->reads_l2 += a->reads_l2 - b->reads_l2;
+    sum->writes_l2 += a->writes_l2 - b->writes_l2;
+    sum->accesses_l2 += a->accesses_l2 - b->accesses_l2;
+    sum->hits_l1 += a->hits_l1 - b->hits_l1;
+    sum->read_hits_l2 += a->read_hits_l2 - b->read_hits_l2;
+    sum->misses_l1 += a->misses_l1 - b->misses_l1;
+    sum->read_misses_l2 += a->read_misses_l2 - b->read_misses_l2;
+    sum->prefetches_l2 += a->prefetches_l2 - b->prefetches_l2;
+    sum->writes_dram += a->writes_dram - b->writes_dram;
+    sum->write_buffer_merges += a->write_buffer_merges - b->write_buffer_merges;
+    sum->useful_prefetches_l2 += a->useful_prefetches_l2 - b->useful_prefetches_l2;
+    sum->polluting_misses_l2 += a->polluting_misses_l2 - b->polluting_misses_l2;
+}
 
-#ifdef DEBUG
-                                printf("Evict from L2: block with valid=%d and index=0x%lx\n", 0, l2_index);
-#endif
-                            }
-                            // deal with prefetch
-                            prefetch(L2, addr, stats);
-                        }
-                        else // When the needed block is in L2
-                        {
-                            updateTimestamp(L2, l2_index, l2_target);
+// Welford's update; windows where the ratio is undefined are left out
+static void addWindowSample(uint64_t &n, double &mean, double &m2, double x)
+{
+    if (std::isnan(x))
+    {
+        return;
+    }
+    n++;
+    double delta = x - mean;
+    mean += delta / n;
+    m2 += delta * (x - mean);
+}
 
-#ifdef DEBUG
-                            printf("L2 read hit");
-#endif
-                        }
-                        // Then Add the needed block to L1
-                        setTag(L1, index, empty_block, tag);
-                        setValidBit(L1, index, empty_block);
-                        updateTimestamp(L1, index, empty_block);
-                    }
-                }
-                else // When No empty blocks in L1
-                {
-                    // LRU
-                    uint64_t lru_index = findLRUBlockIndex(&(L1->sets[index]), num_blocks);
-
-                    if (L2->config.disabled)
-                    {
-                        // Whether this LRU is dirty?
-                        if (getDirtyBit(L1, index, lru_index))
-                        {
-                            setTag(L1, index, lru_index, tag);
-                            clearDirtyBit(L1, index, lru_index);
-                            updateTimestamp(L1, index, lru_index);
-                            stats->writes_l2++;
-                            stats->reads_l2++;
-                            stats->read_misses_l2++;
-                        }
-                        else
-                        {
-                            setTag(L1, index, lru_index, tag);
-                            updateTimestamp(L1, index, lru_index);
-                            stats->reads_l2++;
-                            stats->read_misses_l2++;
-                        }
-                    }
-                    else
-                    {
-                        uint64_t l2_tag = getTag(addr, L2);
-                        uint64_t l2_index = getIndex(addr, L2);
-                        uint64_t l2_num_blocks = 1UL << (L2->config.s);
+// The measured window just ended: add it to the totals and the per-window
+// ratios
+void Simulator::closeWindow()
+{
+    sim_stats_t window;
+    memset(&window, 0, sizeof window);
+    addCounterDelta(&window, &stats, &window_start);
+    addCounterDelta(&measured, &stats, &window_start);
+    computeRatios(&window);
+
+    window_stats.windows++;
+    window_stats.measured_accesses += window.accesses_l1;
+    addWindowSample(window_hit_ratio_l1.n, window_hit_ratio_l1.mean, window_hit_ratio_l1.m2,
+                    window.hit_ratio_l1);
+    addWindowSample(window_read_hit_ratio_l2.n, window_read_hit_ratio_l2.mean, window_read_hit_ratio_l2.m2,
+                    L2->config.disabled ? NAN : window.read_hit_ratio_l2);
+    addWindowSample(window_avg_access_time_l1.n, window_avg_access_time_l1.mean, window_avg_access_time_l1.m2,
+                    window.avg_access_time_l1);
+}
 
-#ifdef DEBUG
-                        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx \n", addr, l2_tag, l2_index);
-#endif
+static double windowVariance(uint64_t n, double m2)
+{
+    return n < 2 ? NAN : m2 / (n - 1);
+}
 
-                        uint64_t l2_target = isInCache('R', addr, stats, L2);
-                        // When the needed block is not in L2
-                        // It needs to select a block to put needed
-                        // block in at first
-                        // L2 miss
-                        if (l2_target == UINT64_MAX)
-                        {
-                            uint64_t l2_empty_block = findEmptyBlockIndex(L2, l2_index, l2_num_blocks);
+// Report only what the complete measured windows saw; a window cut short
+// by the end of the trace is dropped
+void Simulator::finishWindows()
+{
+    stats = measured;
+    window_stats.hit_ratio_l1_mean = window_hit_ratio_l1.n ? window_hit_ratio_l1.mean : NAN;
+    window_stats.hit_ratio_l1_var = windowVariance(window_hit_ratio_l1.n, window_hit_ratio_l1.m2);
+    window_stats.read_hit_ratio_l2_mean = window_read_hit_ratio_l2.n ? window_read_hit_ratio_l2.mean : NAN;
+    window_stats.read_hit_ratio_l2_var = windowVariance(window_read_hit_ratio_l2.n, window_read_hit_ratio_l2.m2);
+    window_stats.avg_access_time_l1_mean = window_avg_access_time_l1.n ? window_avg_access_time_l1.mean : NAN;
+    window_stats.avg_access_time_l1_var = windowVariance(window_avg_access_time_l1.n, window_avg_access_time_l1.m2);
+}
 
-#ifdef DEBUG
-                            printf("L2 read miss\n");
-#endif
-                            // Still empty block in L2
-                            if (l2_empty_block != UINT64_MAX)
-                            {
-                                setTag(L2, l2_index, l2_empty_block, l2_tag);
-                                setValidBit(L2, l2_index, l2_empty_block);
-                                updateTimestamp(L2, l2_index, l2_empty_block);
-                            }
-                            else
-                            {
-                                // LRU
-                                uint64_t l2_lru_index = findLRUBlockIndex(&(L2->sets[l2_index]), l2_num_blocks);
-                                setTag(L2, l2_index, l2_lru_index, l2_tag);
-                                updateTimestamp(L2, l2_index, l2_lru_index);
+// Fast-forward: keep the tags and the replacement state of L1 and L2 as the
+// detailed path would, without statistics, dirty bits or prefetches
+template <class Policy, class Geometry>
+static inline bool warmTouch(cache_t *cache, uint64_t addr)
+{
+    uint64_t index = Geometry::index(cache, addr);
+    uint64_t tag = Geometry::tag(cache, addr);
+    uint64_t block = Geometry::lookup(cache, index, tag);
+    if (block != UINT64_MAX)
+    {
+        Policy::hit(cache, index, block);
+        return true;
+    }
+    block = findEmptyBlockIndex(cache, index, Geometry::ways(cache));
+    if (block == UINT64_MAX)
+    {
+        block = Policy::victim(cache, index);
+    }
+    setTag(cache, index, block, tag);
+    setValidBit(cache, index, block);
+    clearDirtyBit(cache, index, block);
+    Policy::fill(cache, index, block);
+    return false;
+}
 
-#ifdef DEBUG
-                                printf("Evicted from L2: block with valid: %d index: 0x%lx\n",
-                                       0,
-                                       l2_index);
-#endif
-                            }
-                            // deal with prefetch
-                            /* prefetch(L2, addr, stats);
-                            prev_block_addr = blockAddrTrans(L2, addr); */
-                        }
-                        else // When the needed block is in L2
-                        {
-                            updateTimestamp(L2, l2_index, l2_target);
-#ifdef DEBUG
-                            printf("L2 read hit\n");
-#endif
-                        }
-                        // Then Add the needed block to L1
-                        if (getDirtyBit(L1, index, lru_index))
-                        {
-                            uint64_t evicted_tag = L1->sets[index].blocks[lru_index].tag;
-                            uint64_t l1_index_bits = (L1->config.c - L1->config.s - L1->config.b);
-                            uint64_t l1_offset_bits = (L1->config.b);
-                            uint64_t addr = (evicted_tag << (l1_index_bits + l1_offset_bits)) + (index << L1->config.b);
-                            uint64_t l2_tag = getTag(addr, L2);
-                            uint64_t l2_index = getIndex(addr, L2);
-                            uint64_t evicted_target_block = isInCache('W', addr, stats, L2);
-                            // Not in L2
-                            if (evicted_target_block == UINT64_MAX)
-                            {
-                            }
-                            else
-                            {
-                                updateTimestamp(L2, l2_index, evicted_target_block);
-                            }
-                        }
-                        setTag(L1, index, lru_index, tag);
-                        clearDirtyBit(L1, index, lru_index);
-                        updateTimestamp(L1, index, lru_index);
-
-                        if (l2_target == UINT64_MAX)
-                        {
-                            prefetch(L2, addr, stats);
-                        }
-                    }
-#ifdef DEBUG
-                    printf("Evict from L1: block with valid=%d, dirty=%d, tag 0x%lx and index=0x%lx\n",
-                           L1->sets[index].blocks[lru_index].valid_bit,
-                           L1->sets[index].blocks[lru_index].dirty_bit,
-                           tag,
-                           index);
-#endif
-                }
-            }
-        }
-        else // Hit on cache
+template <class Policy, bool HasL2, class L1Geometry, class L2Geometry>
+void Simulator::warmWith(const uint64_t *addrs, const uint8_t *rws, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!warmTouch<Policy, L1Geometry>(L1, addrs[i]) && HasL2)
         {
-#ifdef DEBUG
-            printf("L1 hit\n");
-#endif
-
-            if (rw == 'W')
-            {
-                setDirtyBit(L1, index, l1_target);
-                updateTimestamp(L1, index, l1_target);
-            }
-            if (rw == 'R')
-            {
-                updateTimestamp(L1, index, l1_target);
-            }
+            warmTouch<Policy, L2Geometry>(L2, addrs[i]);
         }
     }
+}
 
-    if (L1->config.replace_policy == REPLACE_POLICY_LFU && L2->config.replace_policy == REPLACE_POLICY_LFU)
+// Point access(), access_batch() and the fast-forward at one instance of
+// the access path
+template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, bool HasL2, class L1Geometry, class L2Geometry>
+void Simulator::useKernel()
+{
+    access_impl = &Simulator::accessWith<Policy, Insert, Prefetch, HasL2, L1Geometry, L2Geometry>;
+    batch_impl = &Simulator::accessBatchWith<Policy, Insert, Prefetch, HasL2, L1Geometry, L2Geometry>;
+    warm_impl = &Simulator::warmWith<Policy, HasL2, L1Geometry, L2Geometry>;
+}
+
+// Pick the access routine instantiated for this configuration
+template <class Policy>
+void Simulator::selectAccess()
+{
+    if (walksLevels())
     {
-        if (l1_target == UINT64_MAX)
+        access_impl = &Simulator::accessLevelsWith<Policy>;
+        batch_impl = &Simulator::accessLevelsBatchWith<Policy>;
+        warm_impl = &Simulator::warmLevelsWith<Policy>;
+    }
+    else if (L2->config.disabled)
+    {
+        if (DirectMappedL1Geometry::matches(L1))
         {
-#ifdef DEBUG
-            printf("L1 miss\n");
-#endif
-            // L1 Write miss
-            if (rw == 'W')
-            {
-                // make sure whether cache set is full
-                uint64_t empty_block = findEmptyBlockIndex(L1, index, num_blocks);
-                // Still have empty blocks
-                if (empty_block != UINT64_MAX)
-                {
-                    // When L2 is disabled
-                    if (L2->config.disabled)
-                    {
-                        setTag(L1, index, empty_block, tag);
-                        setValidBit(L1, index, empty_block);
-                        setDirtyBit(L1, index, empty_block);
-                        setMRUBitNewAndClearOther(L1, index, empty_block);
-                        L1->sets[index].blocks[empty_block].frequency = 1;
-                    }
-                    else // When L2 is enabled
-                    {
-                        uint64_t l2_tag = getTag(addr, L2);
-                        uint64_t l2_index = getIndex(addr, L2);
-                        uint64_t l2_num_blocks = 1UL << (L2->config.s);
-
-#ifdef DEBUG
-                        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx\n", addr, l2_tag, l2_index);
-#endif
-
-                        uint64_t l2_target = isInCache('R', addr, stats, L2);
-                        // When the needed block is not in L2
-                        // It needs to select a block to put needed
-                        // block in at first
-                        // L2 miss
-                        if (l2_target == UINT64_MAX)
-                        {
-#ifdef DEBUG
-                            printf("L2 read miss\n");
-#endif
-                            uint64_t l2_empty_block = findEmptyBlockIndex(L2, l2_index, l2_num_blocks);
-                            // Still empty block in L2
-                            if (l2_empty_block != UINT64_MAX)
-                            {
-                                setTag(L2, l2_index, l2_empty_block, l2_tag);
-                                setValidBit(L2, l2_index, l2_empty_block);
-                                setMRUBitNewAndClearOther(L2, l2_index, l2_empty_block);
-                                L2->sets[l2_index].blocks[l2_empty_block].frequency = 1;
-                            }
-                            else
-                            {
-                                // LFU
-                                uint64_t l2_lfu_index = findLFUBlockIndex(&(L2->sets[l2_index]), l2_num_blocks);
-                                setTag(L2, l2_index, l2_lfu_index, l2_tag);
-                                setMRUBitNewAndClearOther(L2, l2_index, l2_lfu_index);
-                                L2->sets[l2_index].blocks[l2_lfu_index].frequency = 1;
-#ifdef DEBUG
-                                printf("Evict from L2: block with valid=%d and index=0x%lx\n", 0, l2_index);
-#endif
-                            }
-                            // deal with prefetch
-                            prefetch(L2, addr, stats);
-                        }
-                        else // When the needed block is in L2
-                        {
-                            setMRUBitNewAndClearOther(L2, l2_index, l2_target);
-                            L2->sets[l2_index].blocks[l2_target].frequency++;
+            useKernel<Policy, INSERT_POLICY_MIP, PREFETCH_NONE, false, DirectMappedL1Geometry, RuntimeGeometry>();
+        }
+        else if (SetAssocL1Geometry::matches(L1))
+        {
+            useKernel<Policy, INSERT_POLICY_MIP, PREFETCH_NONE, false, SetAssocL1Geometry, RuntimeGeometry>();
+        }
+        else if (FullyAssocL1Geometry::matches(L1))
+        {
+            useKernel<Policy, INSERT_POLICY_MIP, PREFETCH_NONE, false, FullyAssocL1Geometry, RuntimeGeometry>();
+        }
+        else
+        {
+            useKernel<Policy, INSERT_POLICY_MIP, PREFETCH_NONE, false, RuntimeGeometry, RuntimeGeometry>();
+        }
+    }
+    else if (DefaultL1Geometry::matches(L1) && DefaultL2Geometry::matches(L2))
+    {
+        selectL2Access<Policy, DefaultL1Geometry, DefaultL2Geometry>();
+    }
+    else
+    {
+        selectL2Access<Policy, RuntimeGeometry, RuntimeGeometry>();
+    }
+}
+
+// Pick the instance for the L2 prefetcher and insertion policy
+template <class Policy, class L1Geometry, class L2Geometry>
+void Simulator::selectL2Access()
+{
+    prefetch_kind_t kind = prefetchKindOf(&L2->config);
+    bool lip = L2->config.prefetch_insert_policy == INSERT_POLICY_LIP;
+
+    if (kind == PREFETCH_PLUS_ONE && lip)
+    {
+        useKernel<Policy, INSERT_POLICY_LIP, PREFETCH_PLUS_ONE, true, L1Geometry, L2Geometry>();
+    }
+    else if (kind == PREFETCH_PLUS_ONE)
+    {
+        useKernel<Policy, INSERT_POLICY_MIP, PREFETCH_PLUS_ONE, true, L1Geometry, L2Geometry>();
+    }
+    else if (kind == PREFETCH_STRIDED && lip)
+    {
+        useKernel<Policy, INSERT_POLICY_LIP, PREFETCH_STRIDED, true, L1Geometry, L2Geometry>();
+    }
+    else if (kind == PREFETCH_STRIDED)
+    {
+        useKernel<Policy, INSERT_POLICY_MIP, PREFETCH_STRIDED, true, L1Geometry, L2Geometry>();
+    }
+    else
+    {
+        useKernel<Policy, INSERT_POLICY_MIP, PREFETCH_NONE, true, L1Geometry, L2Geometry>();
+    }
+}
+
+template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, bool HasL2, class L1Geometry, class L2Geometry>
+void Simulator::accessWith(char rw, uint64_t addr)
+{
+    accessStep<Policy, Insert, Prefetch, HasL2, L1Geometry, L2Geometry>(
+        rw, addr, L1Geometry::tag(L1, addr), L1Geometry::index(L1, addr), stats);
+}
+
+// The batch works on a local copy of the counters so they can live in
+// registers. Tags and set indices are computed a block at a time ahead of
+// the accesses, and the L1 sets the block will touch are prefetched into
+// the host cache.
+template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, bool HasL2, class L1Geometry, class L2Geometry>
+void Simulator::accessBatchWith(const uint64_t *addrs, const uint8_t *rws, size_t n)
+{
+    uint64_t tags[ACCESS_BATCH_BLOCK];
+    uint64_t sets[ACCESS_BATCH_BLOCK];
+    sim_stats_t st = stats;
+
+    for (size_t base = 0; base < n; base += ACCESS_BATCH_BLOCK)
+    {
+        size_t m = n - base < ACCESS_BATCH_BLOCK ? n - base : ACCESS_BATCH_BLOCK;
+        for (size_t i = 0; i < m; i++)
+        {
+            tags[i] = L1Geometry::tag(L1, addrs[base + i]);
+            sets[i] = L1Geometry::index(L1, addrs[base + i]);
+        }
+        for (size_t i = 0; i < m; i++)
+        {
+            __builtin_prefetch(&L1->tags[sets[i] * L1Geometry::ways(L1)]);
+            __builtin_prefetch(&L1->valid_bits[sets[i] * L1->flag_words]);
+        }
+        for (size_t i = 0; i < m; i++)
+        {
+            accessStep<Policy, Insert, Prefetch, HasL2, L1Geometry, L2Geometry>(
+                rws[base + i], addrs[base + i], tags[i], sets[i], st);
+        }
+    }
+    stats = st;
+}
+
+// One access through L1 (write-back, write-allocate) and, on an L1 miss,
+// L2 (write-through, write-no-allocate)
+// tag and index are addr's L1 tag and set; counters go to st
+template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, bool HasL2, class L1Geometry, class L2Geometry>
+__attribute__((always_inline)) inline void Simulator::accessStep(char rw, uint64_t addr, uint64_t tag, uint64_t index, sim_stats_t &st)
+{
+    uint64_t l1_target = isInCache<L1Geometry>(rw, tag, index, L1, st);
 
 #ifdef DEBUG
-                            printf("L2 read hit");
+    printf("Time: %d Address: 0x%lx Read/Write: %c \n", L1->timestamp_counter, addr, rw);
+    printf("L1 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx \n", addr, tag, index);
 #endif
-                        }
-                        // Then Add the needed block to L1
-                        setTag(L1, index, empty_block, tag);
-                        setValidBit(L1, index, empty_block);
-                        setDirtyBit(L1, index, empty_block);
-                        setMRUBitNewAndClearOther(L1, index, empty_block);
-                        L1->sets[index].blocks[empty_block].frequency = 1;
-
-                        /* if (l2_target == UINT64_MAX)
-                        {
-                            prefetch(L2, addr, stats);
-                        } */
-                    }
-                }
-                else // L1 is full set of blocks and eviction is needed
-                {
-                    // LFU
-                    uint64_t lfu_index = findLFUBlockIndex(&(L1->sets[index]), num_blocks);
-
-                    if (L2->config.disabled)
-                    {
-                        // Whether this LFU is dirty?
-                        if (getDirtyBit(L1, index, lfu_index))
-                        {
-                            setTag(L1, index, lfu_index, tag);
-                            setDirtyBit(L1, index, lfu_index);
-                            setMRUBitNewAndClearOther(L1, index, lfu_index);
-                            L1->sets[index].blocks[lfu_index].frequency = 1;
-                        }
-                        else
-                        {
-                            setTag(L1, index, lfu_index, tag);
-                            setDirtyBit(L1, index, lfu_index);
-                            setMRUBitNewAndClearOther(L1, index, lfu_index);
-                            L1->sets[index].blocks[lfu_index].frequency = 1;
-                        }
-                    }
-                    else
-                    {
-                        uint64_t l2_tag = getTag(addr, L2);
-                        uint64_t l2_index = getIndex(addr, L2);
-                        uint64_t l2_num_blocks = 1UL << (L2->config.s);
+
+    if (l1_target != UINT64_MAX)
+    {
 #ifdef DEBUG
-                        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx \n", addr, l2_tag, l2_index);
+        printf("L1 hit\n");
 #endif
-                        uint64_t l2_target = isInCache('R', addr, stats, L2);
-                        // When the needed block is not in L2
-                        // It needs to select a block to put needed
-                        // block in at first
-                        // L2 miss
-                        if (l2_target == UINT64_MAX)
-                        {
+        if (rw == 'W')
+        {
+            setDirtyBit(L1, index, l1_target);
+        }
+        Policy::hit(L1, index, l1_target);
+        return;
+    }
+
 #ifdef DEBUG
-                            printf("L2 read miss\n");
+    printf("L1 miss\n");
 #endif
-                            uint64_t l2_empty_block = findEmptyBlockIndex(L2, l2_index, l2_num_blocks);
-                            // Still empty block in L2
-                            if (l2_empty_block != UINT64_MAX)
-                            {
-                                setTag(L2, l2_index, l2_empty_block, l2_tag);
-                                setValidBit(L2, l2_index, l2_empty_block);
-                                setMRUBitNewAndClearOther(L2, l2_index, l2_empty_block);
-                                L2->sets[l2_index].blocks[l2_empty_block].frequency = 1;
-                            }
-                            else
-                            {
-                                // LFU
-                                uint64_t l2_lfu_index = findLFUBlockIndex(&(L2->sets[l2_index]), l2_num_blocks);
-                                setTag(L2, l2_index, l2_lfu_index, l2_tag);
-                                setMRUBitNewAndClearOther(L2, l2_index, l2_lfu_index);
-                                L2->sets[l2_index].blocks[l2_lfu_index].frequency = 1;
+    // Fill an empty way if the set has one, otherwise evict
+    uint64_t l1_block = findEmptyBlockIndex(L1, index, L1Geometry::ways(L1));
+    bool evict = l1_block == UINT64_MAX;
+    if (evict)
+    {
+        l1_block = Policy::victim(L1, index);
+    }
+    bool write_back = evict && getDirtyBit(L1, index, l1_block);
+    // With or without L2 (which writes through), a dirty victim reaches DRAM
+    st.writes_dram += write_back;
 
+    if (!HasL2)
+    {
+        if (Policy::counts_l2_when_disabled)
+        {
+            st.reads_l2++;
+            st.read_misses_l2++;
+            if (write_back)
+            {
+                st.writes_l2++;
+            }
+        }
+    }
+    else
+    {
+        uint64_t l2_tag = L2Geometry::tag(L2, addr);
+        uint64_t l2_index = L2Geometry::index(L2, addr);
 #ifdef DEBUG
-                                printf("Evicted from L2: block with valid: %d index: 0x%lx\n",
-                                       0,
-                                       l2_index);
+        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx \n", addr, l2_tag, l2_index);
 #endif
-                            }
-                            prefetch(L2, addr, stats);
-                        }
-                        else // When the needed block is in L2
-                        {
-                            setMRUBitNewAndClearOther(L2, l2_index, l2_target);
-                            L2->sets[l2_index].blocks[l2_target].frequency++;
+        uint64_t l2_target = isInCache<L2Geometry>('R', l2_tag, l2_index, L2, st);
+        bool l2_miss = l2_target == UINT64_MAX;
+
+        if (l2_miss)
+        {
 #ifdef DEBUG
-                            printf("L2 read hit\n");
+            printf("L2 read miss\n");
 #endif
-                        }
-                        // Then Add the needed block to L1
-                        // While deal with the evicted
-                        // While the dirtybit is set,
-                        // the block needs to be write in L2
-                        if (getDirtyBit(L1, index, lfu_index))
-                        {
-                            uint64_t evicted_tag = L1->sets[index].blocks[lfu_index].tag;
-                            uint64_t l1_index_bits = (L1->config.c - L1->config.s - L1->config.b);
-                            uint64_t l1_offset_bits = (L1->config.b);
-                            uint64_t addr = (evicted_tag << (l1_index_bits + l1_offset_bits)) + (index << L1->config.b);
-                            uint64_t l2_tag = getTag(addr, L2);
-                            uint64_t l2_index = getIndex(addr, L2);
-                            uint64_t evicted_target_block = isInCache('W', addr, stats, L2);
-
-                            // Not in L2
-                            if (evicted_target_block == UINT64_MAX)
-                            {
-                            }
-                            else
-                            {
-                                setMRUBitNewAndClearOther(L2, l2_index, evicted_target_block);
-                                L2->sets[l2_index].blocks[evicted_target_block].frequency++;
-                            }
-                        }
-                        setTag(L1, index, lfu_index, tag);
-                        setDirtyBit(L1, index, lfu_index);
-                        setMRUBitNewAndClearOther(L1, index, lfu_index);
-                        L1->sets[index].blocks[lfu_index].frequency = 1;
-
-                        /* if (l2_target == UINT64_MAX)
-                        {
-                            prefetch(L2, addr, stats);
-                        } */
-                    }
+            uint64_t l2_block = findEmptyBlockIndex(L2, l2_index, L2Geometry::ways(L2));
+            if (l2_block == UINT64_MAX)
+            {
+                l2_block = Policy::victim(L2, l2_index);
 #ifdef DEBUG
-                    printf("Evict from L1: block with valid=%d, dirty=%d, tag 0x%lx and index=0x%lx\n",
-                           L1->sets[index].blocks[lfu_index].valid_bit,
-                           L1->sets[index].blocks[lfu_index].dirty_bit,
-                           tag,
-                           index);
+                printf("Evict from L2: block with valid=%d and index=0x%lx\n", 0, l2_index);
 #endif
-                }
             }
-
-            // Read miss
-            if (rw == 'R')
-            {
-                // make sure whether cache set is full
-                uint64_t empty_block = findEmptyBlockIndex(L1, index, num_blocks);
-                if (empty_block != UINT64_MAX)
-                {
-
-                    if (L2->config.disabled)
-                    {
-                        setTag(L1, index, empty_block, tag);
-                        setValidBit(L1, index, empty_block);
-                        setMRUBitNewAndClearOther(L1, index, empty_block);
-                        L1->sets[index].blocks[empty_block].frequency = 1;
-                    }
-                    else
-                    {
-                        uint64_t l2_tag = getTag(addr, L2);
-                        uint64_t l2_index = getIndex(addr, L2);
-                        uint64_t l2_num_blocks = 1UL << (L2->config.s);
+            setTag(L2, l2_index, l2_block, l2_tag);
+            setValidBit(L2, l2_index, l2_block);
+            Policy::fill(L2, l2_index, l2_block);
+        }
+        else
+        {
+            Policy::hit(L2, l2_index, l2_target);
 #ifdef DEBUG
-                        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx\n", addr, l2_tag, l2_index);
+            printf("L2 read hit\n");
 #endif
+        }
 
-                        uint64_t l2_target = isInCache('R', addr, stats, L2);
-                        // When the needed block is not in L2
-                        // It needs to select a block to put needed
-                        // block in at first
-                        if (l2_target == UINT64_MAX)
-                        {
-#ifdef DEBUG
-                            printf("L2 read miss\n");
-#endif
+        if (l2_miss && (!evict || Policy::prefetch_before_writeback))
+        {
+            prefetchWith<Policy, Insert, Prefetch, L2Geometry>(addr, st);
+        }
+        // A dirty victim is written through to L2, which only updates the
+        // block's recency if L2 holds it
+        if (write_back)
+        {
+            uint64_t evicted_addr = L1Geometry::addrOf(L1, getBlockTag(L1, index, l1_block), index);
+            uint64_t evicted_index = L2Geometry::index(L2, evicted_addr);
+            uint64_t evicted_tag = L2Geometry::tag(L2, evicted_addr);
+            uint64_t evicted_target_block = isInCache<L2Geometry>('W', evicted_tag, evicted_index, L2, st);
+            if (evicted_target_block != UINT64_MAX)
+            {
+                Policy::hit(L2, evicted_index, evicted_target_block);
+            }
+        }
+        if (l2_miss && evict && !Policy::prefetch_before_writeback)
+        {
+            prefetchWith<Policy, Insert, Prefetch, L2Geometry>(addr, st);
+        }
+    }
 
-                            uint64_t l2_empty_block = findEmptyBlockIndex(L2, l2_index, l2_num_blocks);
-                            // Still have empty block in L2
-                            if (l2_empty_block != UINT64_MAX)
-                            {
-                                setTag(L2, l2_index, l2_empty_block, l2_tag);
-                                setValidBit(L2, l2_index, l2_empty_block);
-                                setMRUBitNewAndClearOther(L2, l2_index, l2_empty_block);
-                                L2->sets[l2_index].blocks[l2_empty_block].frequency = 1;
-                            }
-                            else
-                            {
-                                // LFU
-                                uint64_t l2_lfu_index = findLFUBlockIndex(&(L2->sets[l2_index]), l2_num_blocks);
-
-                                setTag(L2, l2_index, l2_lfu_index, l2_tag);
-                                setMRUBitNewAndClearOther(L2, l2_index, l2_lfu_index);
-                                L2->sets[l2_index].blocks[l2_lfu_index].frequency = 1;
+    // Then add the needed block to L1
+    setTag(L1, index, l1_block, tag);
+    setValidBit(L1, index, l1_block);
+    if (rw == 'W')
+    {
+        setDirtyBit(L1, index, l1_block);
+    }
+    else
+    {
+        clearDirtyBit(L1, index, l1_block);
+    }
+    Policy::fill(L1, index, l1_block);
 
 #ifdef DEBUG
-                                printf("Evict from L2: block with valid=%d and index=0x%lx\n", 0, l2_index);
-#endif
-                            }
-                            // deal with prefetch
-                            prefetch(L2, addr, stats);
-                        }
-                        else // When the needed block is in L2
-                        {
-                            setMRUBitNewAndClearOther(L2, l2_index, l2_target);
-                            L2->sets[l2_index].blocks[l2_target].frequency++;
-#ifdef DEBUG
-                            printf("L2 read hit");
-#endif
-                        }
-                        // Then Add the needed block to L1
-                        setTag(L1, index, empty_block, tag);
-                        setValidBit(L1, index, empty_block);
-                        setMRUBitNewAndClearOther(L1, index, empty_block);
-                        L1->sets[index].blocks[empty_block].frequency = 1;
-                    }
-                }
-                else // When No empty blocks in L1
-                {
-                    // LFU
-                    uint64_t lfu_index = findLFUBlockIndex(&(L1->sets[index]), num_blocks);
-
-                    if (L2->config.disabled)
-                    {
-                        // Whether this LFU is dirty?
-                        if (getDirtyBit(L1, index, lfu_index))
-                        {
-                            setTag(L1, index, lfu_index, tag);
-                            clearDirtyBit(L1, index, lfu_index);
-                            setMRUBitNewAndClearOther(L1, index, lfu_index);
-                            L1->sets[index].blocks[lfu_index].frequency = 1;
-                        }
-                        else
-                        {
-                            setTag(L1, index, lfu_index, tag);
-                            setMRUBitNewAndClearOther(L1, index, lfu_index);
-                            L1->sets[index].blocks[lfu_index].frequency = 1;
-                        }
-                    }
-                    else
-                    {
-                        uint64_t l2_tag = getTag(addr, L2);
-                        uint64_t l2_index = getIndex(addr, L2);
-                        uint64_t l2_num_blocks = 1UL << (L2->config.s);
-#ifdef DEBUG
-                        printf("L2 decomposed address 0x%lx -> Tag: 0x%lx and Index: 0x%lx \n", addr, l2_tag, l2_index);
+    if (evict)
+    {
+        printf("Evict from L1: block with valid=%d, dirty=%d, tag 0x%lx and index=0x%lx\n",
+               getValidBit(L1, index, l1_block),
+               getDirtyBit(L1, index, l1_block),
+               tag,
+               index);
+    }
 #endif
+}
+
+bool Simulator::walksLevels() const
+{
+    if (num_levels > 1 && L2->config.inclusion != INCLUSION_NINE)
+    {
+        return true;
+    }
+    for (uint64_t level = 2; level < num_levels; level++)
+    {
+        if (outer[level - 2]->config.inclusion != INCLUSION_NINE)
+        {
+            return true;
+        }
+    }
+    // The kernels prefetch one block with +1 or strided
+    prefetch_kind_t l2_prefetch = prefetchKindOf(&L2->config);
+    if (num_levels > 1 && l2_prefetch != PREFETCH_NONE &&
+        (l2_prefetch > PREFETCH_STRIDED || L2->config.prefetch_degree != 1 || L2->config.prefetch_distance != 1))
+    {
+        return true;
+    }
+    return L1I != NULL || victims.num_entries || config.write_buffer_depth || config.prefetch_stats || num_levels > 2 ||
+           L1->config.write_strat != WRITE_STRAT_WBWA ||
+           (num_levels == 2 && L2->config.write_strat != WRITE_STRAT_WTWNA);
+}
+
+static inline bool writesBack(const cache *c)
+{
+    return c->config.write_strat == WRITE_STRAT_WBWA || c->config.write_strat == WRITE_STRAT_WBWNA;
+}
+
+static inline bool allocatesOnWrite(const cache *c)
+{
+    return c->config.write_strat == WRITE_STRAT_WBWA || c->config.write_strat == WRITE_STRAT_WTWA;
+}
+
+cache *Simulator::levelCache(uint64_t level) const
+{
+    if (level == 0)
+    {
+        return L1;
+    }
+    return level == 1 ? L2 : outer[level - 2];
+}
+
+// One CPU access through the level walk. L1 counts every access; a write
+// that misses a write-no-allocate L1 goes straight to the level below, and
+// one that misses a write-through, write-allocate L1 is written through
+// after the fill.
+template <class Policy>
+void Simulator::accessLevelsWith(char rw, uint64_t addr)
+{
+    if (rw == FETCH && L1I != NULL)
+    {
+        fetchLevelsWith<Policy>(addr);
+        return;
+    }
+
+    uint64_t index = getIndex(addr, L1);
+    uint64_t tag = getTag(addr, L1);
+    bool write_through = !writesBack(L1);
+
+    stats.accesses_l1++;
+    if (rw == WRITE)
+    {
+        stats.writes++;
+    }
+    else
+    {
+        stats.reads++;
+    }
+
+    uint64_t block = findValidBlockIndex(L1, index, tag);
+    if (block != UINT64_MAX)
+    {
+        stats.hits_l1++;
+        if (rw == WRITE && write_through)
+        {
+            writeLevel<Policy>(1, addr);
+        }
+        else if (rw == WRITE)
+        {
+            setDirtyBit(L1, index, block);
+        }
+        Policy::hit(L1, index, block);
+        return;
+    }
+
+    stats.misses_l1++;
+    if (rw == WRITE && !allocatesOnWrite(L1))
+    {
+        // The victim cache belongs to L1 and takes the write if it has the block
+        if (!write_through && victims.num_entries && victimHolds(&victims, addr))
+        {
+            putVictim<Policy>(addr, true);
+            return;
+        }
+        writeLevel<Policy>(1, addr);
+        return;
+    }
+    fillLevel<Policy>(L1, 0, addr, true, rw == WRITE && !write_through);
+    if (rw == WRITE && write_through)
+    {
+        writeLevel<Policy>(1, addr);
+    }
+}
+
+// Fetches and data accesses stay interleaved in trace order. As in
+// accessBatchWith(), the L1 sets a block of accesses will touch, in
+// whichever L1 each one goes to, are prefetched into the host cache first.
+template <class Policy>
+void Simulator::accessLevelsBatchWith(const uint64_t *addrs, const uint8_t *rws, size_t n)
+{
+    for (size_t base = 0; base < n; base += ACCESS_BATCH_BLOCK)
+    {
+        size_t m = n - base < ACCESS_BATCH_BLOCK ? n - base : ACCESS_BATCH_BLOCK;
+        for (size_t i = base; i < base + m; i++)
+        {
+            cache *c = rws[i] == FETCH && L1I != NULL ? L1I : L1;
+            uint64_t index = getIndex(addrs[i], c);
+            __builtin_prefetch(&c->tags[index * c->num_ways]);
+            __builtin_prefetch(&c->valid_bits[index * c->flag_words]);
+        }
+        for (size_t i = base; i < base + m; i++)
+        {
+            accessLevelsWith<Policy>(rws[i], addrs[i]);
+        }
+    }
+}
+
+// An instruction fetch into the L1I of a split L1. The L1I is read-only, so
+// its blocks are never dirty.
+template <class Policy>
+void Simulator::fetchLevelsWith(uint64_t addr)
+{
+    uint64_t index = getIndex(addr, L1I);
+    stats.accesses_l1i++;
+    uint64_t block = findValidBlockIndex(L1I, index, getTag(addr, L1I));
+    if (block != UINT64_MAX)
+    {
+        stats.hits_l1i++;
+        Policy::hit(L1I, index, block);
+        return;
+    }
+    stats.misses_l1i++;
+    fillLevel<Policy>(L1I, 0, addr, true, false);
+}
+
+// Fast-forward for the level walk, see warmWith(). Like the prefetchers,
+// inclusion policies are left out.
+template <class Policy>
+void Simulator::warmLevelsWith(const uint64_t *addrs, const uint8_t *rws, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        for (uint64_t level = 0; level < num_levels; level++)
+        {
+            if (warmTouch<Policy, RuntimeGeometry>(levelCache(level), addrs[i]))
+            {
+                break;
+            }
+        }
+    }
+}
+
+// Demand read of addr's block from a level below L1, which allocates it on
+// a miss. Returns whether it missed; the caller then runs the level's
+// prefetcher, so that it lands in the same place relative to the caller's
+// write-back as in the two-level kernels. An exclusive level gives up a hit
+// block to the level above instead, setting *dirty if it held it dirty,
+// and lets a missed block pass through it.
+// The first hit to a prefetched block makes the prefetch useful, and a
+// miss to a block a prefetch evicted is pollution.
+template <class Policy>
+bool Simulator::readLevel(uint64_t level, uint64_t addr, bool *dirty)
+{
+    cache *c = levelCache(level);
+    uint64_t index = getIndex(addr, c);
+    uint64_t block = findValidBlockIndex(c, index, getTag(addr, c));
+    bool exclusive = c->config.inclusion == INCLUSION_EXCLUSIVE;
+    countRead(level, block != UINT64_MAX);
+    if (block != UINT64_MAX)
+    {
+        bool prefetched = getPrefetchedBit(c, index, block);
+        clearPrefetchedBit(c, index, block);
+        if (exclusive)
+        {
+            *dirty |= getDirtyBit(c, index, block);
+            clearValidBit(c, index, block);
+            clearDirtyBit(c, index, block);
+        }
+        else
+        {
+            Policy::hit(c, index, block);
+        }
+        if (prefetched)
+        {
+            countUsefulPrefetch(level);
+            if (prefetchTrainsOnHits(prefetchKindOf(&c->config)))
+            {
+                prefetchLevel<Policy>(level, addr);
+            }
+        }
+        return false;
+    }
+    if (takePrefetchVictim(&prefetchers[level - 1], c->config.b, blockAddrTrans(c, addr)))
+    {
+        countPollutingMiss(level);
+    }
+    if (!exclusive)
+    {
+        fillLevel<Policy>(c, level, addr, true, false);
+    }
+    else if (level + 1 < num_levels && readLevel<Policy>(level + 1, addr, dirty))
+    {
+        prefetchLevel<Policy>(level + 1, addr);
+    }
+    return true;
+}
+
+// A write-back or write-through arriving at level from above. A
+// write-through level passes it on and a write-back level keeps it. On a
+// miss a write-allocate level allocates the block without reading it from
+// below, since the whole block is written; a write-no-allocate one passes
+// the write on.
+template <class Policy>
+void Simulator::writeLevel(uint64_t level, uint64_t addr)
+{
+    if (level >= num_levels)
+    {
+        if (level == 1 && Policy::counts_l2_when_disabled)
+        {
+            stats.writes_l2++;
+        }
+        writeMemory(addr);
+        return;
+    }
+
+    cache *c = levelCache(level);
+    uint64_t index = getIndex(addr, c);
+    uint64_t block = findValidBlockIndex(c, index, getTag(addr, c));
+    bool write_back = writesBack(c);
+    countWrite(level);
+    if (block != UINT64_MAX)
+    {
+        if (write_back)
+        {
+            setDirtyBit(c, index, block);
+        }
+        Policy::hit(c, index, block);
+    }
+    else if (allocatesOnWrite(c))
+    {
+        takePrefetchVictim(&prefetchers[level - 1], c->config.b, blockAddrTrans(c, addr));
+        fillLevel<Policy>(c, level, addr, false, write_back);
+    }
+    if (!write_back || (block == UINT64_MAX && !allocatesOnWrite(c)))
+    {
+        writeLevel<Policy>(level + 1, addr);
+    }
+}
+
+// Allocate addr's block in cache c of level (L1I counts as level 0) after
+// a miss: pick a way, read the block from the level below if fetch, hand
+// the victim down, then fill
+template <class Policy>
+void Simulator::fillLevel(cache *c, uint64_t level, uint64_t addr, bool fetch, bool dirty)
+{
+    uint64_t index = getIndex(addr, c);
+    uint64_t block = findEmptyBlockIndex(c, index, c->num_ways);
+    bool evict = block == UINT64_MAX;
+    if (evict)
+    {
+        block = Policy::victim(c, index);
+    }
+    bool write_back = evict && getDirtyBit(c, index, block);
+    uint64_t victim_addr = RuntimeGeometry::addrOf(c, getBlockTag(c, index, block), index);
+    if (evict && c->config.inclusion == INCLUSION_INCLUSIVE && level > 0)
+    {
+        write_back |= backInvalidate(level, victim_addr);
+    }
+
+    // The victim cache sits between the L1 data cache and L2 only
+    bool victim_cache = c == L1 && victims.num_entries;
+    uint64_t next = level + 1;
+    if (next < num_levels)
+    {
+        bool from_victims = victim_cache && takeVictim(addr, &dirty);
+        bool missed = fetch && !from_victims && readLevel<Policy>(next, addr, &dirty);
+        if (!fetch)
+        {
+            takeFromBelow(level, addr, &dirty);
+        }
+        bool prefetch_first = !evict || Policy::prefetch_before_writeback;
+        if (missed && prefetch_first)
+        {
+            prefetchLevel<Policy>(next, addr);
+        }
+        // An inclusive level below may have back-invalidated the victim by
+        // now. Once handed down it is dropped, so that nothing below finds
+        // it here again.
+        if (evict && getValidBit(c, index, block) && victim_cache)
+        {
+            putVictim<Policy>(victim_addr, write_back);
+            clearValidBit(c, index, block);
+        }
+        else if (evict && getValidBit(c, index, block))
+        {
+            evictLevel<Policy>(level, victim_addr, write_back);
+            clearValidBit(c, index, block);
+        }
+        if (missed && !prefetch_first)
+        {
+            prefetchLevel<Policy>(next, addr);
+        }
+        includeIn<Policy>(next, addr);
+    }
+    else
+    {
+        if (level == 0 && Policy::counts_l2_when_disabled)
+        {
+            stats.reads_l2++;
+            stats.read_misses_l2++;
+        }
+        if (write_back)
+        {
+            writeLevel<Policy>(next, victim_addr);
+        }
+    }
+
+    setTag(c, index, block, getTag(addr, c));
+    setValidBit(c, index, block);
+    clearPrefetchedBit(c, index, block);
+    if (dirty)
+    {
+        setDirtyBit(c, index, block);
+    }
+    else
+    {
+        clearDirtyBit(c, index, block);
+    }
+    Policy::fill(c, index, block);
+}
+
+// The level's own prefetcher after a demand miss on addr, like
+// prefetchWith(), with any prefetcher, degree and distance. Prefetched
+// blocks come from memory and leave the levels below alone.
+template <class Policy>
+void Simulator::prefetchLevel(uint64_t level, uint64_t addr)
+{
+    cache *c = levelCache(level);
+    prefetch_kind_t kind = prefetchKindOf(&c->config);
+    if (kind == PREFETCH_NONE)
+    {
+        return;
+    }
+
+    uint64_t candidates[PREFETCH_MAX_DEGREE];
+    uint64_t n = prefetchCandidates(&prefetchers[level - 1], kind, c->config.prefetch_degree,
+                                    c->config.prefetch_distance, c->config.b, blockAddrTrans(c, addr), candidates);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        prefetchBlock<Policy>(level, addr, candidates[i]);
+    }
+}
+
+// Bring the block at new_block_addr into level, placed by the level's
+// insertion policy, unless it is there already. Every prefetcher goes
+// through here.
+template <class Policy>
+void Simulator::prefetchBlock(uint64_t level, uint64_t addr, uint64_t new_block_addr)
+{
+    cache *c = levelCache(level);
+    uint64_t index = getIndex(new_block_addr, c);
+    uint64_t tag = getTag(new_block_addr, c);
+    // An exclusive level leaves blocks held above alone, as well as the
+    // demand block on its way up (a zero stride)
+    if (findValidBlockIndex(c, index, tag) != UINT64_MAX ||
+        (c->config.inclusion == INCLUSION_EXCLUSIVE &&
+         (new_block_addr == blockAddrTrans(c, addr) || heldAbove(level, new_block_addr))))
+    {
+        return;
+    }
+
+    countPrefetch(level);
+    bool dirty = false;
+    takeFromBelow(level, new_block_addr, &dirty);
+    uint64_t block = findEmptyBlockIndex(c, index, c->num_ways);
+    if (block == UINT64_MAX)
+    {
+        block = Policy::victim(c, index);
+        uint64_t victim_addr = RuntimeGeometry::addrOf(c, getBlockTag(c, index, block), index);
+        bool write_back = getDirtyBit(c, index, block);
+        if (c->config.inclusion == INCLUSION_INCLUSIVE)
+        {
+            write_back |= backInvalidate(level, victim_addr);
+        }
+        notePrefetchVictim(&prefetchers[level - 1], c->config.b, victim_addr);
+        evictLevel<Policy>(level, victim_addr, write_back);
+        clearValidBit(c, index, block);
+    }
+    takePrefetchVictim(&prefetchers[level - 1], c->config.b, new_block_addr);
+    includeIn<Policy>(level + 1, new_block_addr);
+    setTag(c, index, block, tag);
+    setValidBit(c, index, block);
+    setPrefetchedBit(c, index, block);
+    if (dirty)
+    {
+        setDirtyBit(c, index, block);
+    }
+    else
+    {
+        clearDirtyBit(c, index, block);
+    }
+    Policy::prefetchFill(c, index, block, c->config.prefetch_insert_policy);
+}
+
+// Hand a block evicted from level to the level below: every victim moves
+// into an exclusive level, otherwise only dirty ones are written back
+template <class Policy>
+void Simulator::evictLevel(uint64_t level, uint64_t victim_addr, bool dirty)
+{
+    uint64_t next = level + 1;
+    if (next < num_levels && levelCache(next)->config.inclusion == INCLUSION_EXCLUSIVE)
+    {
+        insertVictim<Policy>(next, victim_addr, dirty);
+    }
+    else if (dirty)
+    {
+        writeLevel<Policy>(next, victim_addr);
+    }
+}
+
+// Place a victim of the level above in exclusive level. A write-through
+// level keeps it clean and passes dirty data on.
+template <class Policy>
+void Simulator::insertVictim(uint64_t level, uint64_t addr, bool dirty)
+{
+    cache *c = levelCache(level);
+    uint64_t index = getIndex(addr, c);
+    uint64_t block = findValidBlockIndex(c, index, getTag(addr, c));
+    bool write_back = writesBack(c);
+    countWrite(level);
+    if (block != UINT64_MAX)
+    {
+        if (dirty && write_back)
+        {
+            setDirtyBit(c, index, block);
+        }
+        Policy::hit(c, index, block);
+    }
+    else
+    {
+        fillLevel<Policy>(c, level, addr, false, dirty && write_back);
+    }
+    if (dirty && !write_back)
+    {
+        writeLevel<Policy>(level + 1, addr);
+    }
+}
+
+// Put a block into the first inclusive level from level down, when it
+// reached the levels above without a read through that level (a prefetch
+// or a write-allocate above, or an eviction from the level since the
+// read). Levels further down include that one, so they follow.
+template <class Policy>
+void Simulator::includeIn(uint64_t level, uint64_t addr)
+{
+    for (; level < num_levels; level++)
+    {
+        cache *c = levelCache(level);
+        if (c->config.inclusion != INCLUSION_INCLUSIVE)
+        {
+            continue;
+        }
+        if (findValidBlockIndex(c, getIndex(addr, c), getTag(addr, c)) == UINT64_MAX)
+        {
+            fillLevel<Policy>(c, level, addr, false, false);
+        }
+        return;
+    }
+}
+
+// A block that level allocates without reading it moves up out of an
+// exclusive level below, if there
+void Simulator::takeFromBelow(uint64_t level, uint64_t addr, bool *dirty)
+{
+    if (level + 1 < num_levels && levelCache(level + 1)->config.inclusion == INCLUSION_EXCLUSIVE)
+    {
+        invalidateIn(levelCache(level + 1), addr, dirty);
+    }
+}
+
+// A write leaving the last level. Without a write buffer it goes straight
+// to DRAM. Otherwise it waits in the buffer, where later writes to the same
+// block merge into it, until the buffer is full and drains its oldest
+// entry.
+void Simulator::writeMemory(uint64_t addr)
+{
+    uint64_t depth = config.write_buffer_depth;
+    if (depth == 0)
+    {
+        stats.writes_dram++;
+        return;
+    }
+    uint64_t block_addr = addr >> L1->config.b;
+    for (uint64_t i = 0; i < write_buffer_count; i++)
+    {
+        if (write_buffer[(write_buffer_head + i) % depth] == block_addr)
+        {
+            stats.write_buffer_merges++;
+            return;
+        }
+    }
+    if (write_buffer_count == depth)
+    {
+        stats.writes_dram++;
+        write_buffer_head = (write_buffer_head + 1) % depth;
+        write_buffer_count--;
+    }
+    write_buffer[(write_buffer_head + write_buffer_count) % depth] = block_addr;
+    write_buffer_count++;
+}
+
+// Writes still in the buffer at the end of the run reach DRAM too
+void Simulator::drainWriteBuffer()
+{
+    stats.writes_dram += write_buffer_count;
+    write_buffer_head = 0;
+    write_buffer_count = 0;
+}
+
+// Move addr's block from the victim cache back into L1 on an L1 miss
+bool Simulator::takeVictim(uint64_t addr, bool *dirty)
+{
+    if (victimTake(&victims, addr, dirty))
+    {
+        stats.hits_vc++;
+        return true;
+    }
+    stats.misses_vc++;
+    return false;
+}
+
+// Keep an L1 victim in the victim cache, which hands its own LRU entry on
+// to the level below as if L1 had evicted it
+template <class Policy>
+void Simulator::putVictim(uint64_t addr, bool dirty)
+{
+    uint64_t evicted_addr;
+    bool evicted_dirty;
+    if (victimPut(&victims, addr, dirty, &evicted_addr, &evicted_dirty))
+    {
+        evictLevel<Policy>(0, evicted_addr, evicted_dirty);
+    }
+}
+
+// Drop addr's block from c, if there, adding whether it was dirty to
+// *dirty. Returns whether it was there.
+bool Simulator::invalidateIn(cache *c, uint64_t addr, bool *dirty)
+{
+    uint64_t index = getIndex(addr, c);
+    uint64_t block = findValidBlockIndex(c, index, getTag(addr, c));
+    if (block == UINT64_MAX)
+    {
+        return false;
+    }
+    *dirty |= getDirtyBit(c, index, block);
+    clearValidBit(c, index, block);
+    clearDirtyBit(c, index, block);
+    return true;
+}
+
+// Keep inclusive level a superset of the levels above it after it evicts
+// addr's block. The levels share the block size, so the block can only be
+// in the one set of each cache that its address indexes, and no set is
+// scanned. Returns whether any copy above was dirty.
+bool Simulator::backInvalidate(uint64_t level, uint64_t addr)
+{
+    bool dirty = false;
+    if (L1I != NULL && invalidateIn(L1I, addr, &dirty))
+    {
+        stats.back_invalidations++;
+    }
+    if (victims.num_entries && victimTake(&victims, addr, &dirty))
+    {
+        stats.back_invalidations++;
+    }
+    for (uint64_t above = 0; above < level; above++)
+    {
+        if (invalidateIn(levelCache(above), addr, &dirty))
+        {
+            stats.back_invalidations++;
+        }
+    }
+    return dirty;
+}
+
+bool Simulator::heldAbove(uint64_t level, uint64_t addr) const
+{
+    if (L1I != NULL && findValidBlockIndex(L1I, getIndex(addr, L1I), getTag(addr, L1I)) != UINT64_MAX)
+    {
+        return true;
+    }
+    if (victims.num_entries && victimHolds(&victims, addr))
+    {
+        return true;
+    }
+    for (uint64_t above = 0; above < level; above++)
+    {
+        cache *c = levelCache(above);
+        if (findValidBlockIndex(c, getIndex(addr, c), getTag(addr, c)) != UINT64_MAX)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Simulator::countRead(uint64_t level, bool hit)
+{
+    if (level == 1)
+    {
+        stats.accesses_l2++;
+        stats.reads_l2++;
+        if (hit)
+        {
+            stats.read_hits_l2++;
+        }
+        else
+        {
+            stats.read_misses_l2++;
+        }
+        return;
+    }
+    sim_level_stats_t *st = &outer_stats[level - 2];
+    st->reads++;
+    if (hit)
+    {
+        st->read_hits++;
+    }
+    else
+    {
+        st->read_misses++;
+    }
+}
+
+void Simulator::countWrite(uint64_t level)
+{
+    if (level == 1)
+    {
+        stats.accesses_l2++;
+        stats.writes_l2++;
+        return;
+    }
+    outer_stats[level - 2].writes++;
+}
+
+void Simulator::countPrefetch(uint64_t level)
+{
+    if (level == 1)
+    {
+        stats.prefetches_l2++;
+        return;
+    }
+    outer_stats[level - 2].prefetches++;
+}
+
+void Simulator::countUsefulPrefetch(uint64_t level)
+{
+    if (level == 1)
+    {
+        stats.useful_prefetches_l2++;
+        return;
+    }
+    outer_stats[level - 2].useful_prefetches++;
+}
+
+void Simulator::countPollutingMiss(uint64_t level)
+{
+    if (level == 1)
+    {
+        stats.polluting_misses_l2++;
+        return;
+    }
+    outer_stats[level - 2].polluting_misses++;
+}
+
+/**
+ * Subroutine for cleaning up any outstanding memory operations and calculating overall statistics
+ * such as miss rate or average access time.
+ * TODO: You're responsible for completing this routine
+ */
+void Simulator::finish()
+{
+    drainWriteBuffer();
+    if (sampling)
+    {
+        finishSampling();
+    }
+    if (windowing)
+    {
+        finishWindows();
+    }
+    computeLevelRatios();
+    computeRatios(&stats);
+    if (sampling)
+    {
+        // First order propagation of both ratio errors through the AAT
+        double l2_err = L2->config.disabled ? 0 : sample_stats.read_miss_ratio_l2_err;
+        sample_stats.avg_access_time_l1_err =
+            stats.avg_access_time_l2 * sample_stats.miss_ratio_l1_err +
+            stats.miss_ratio_l1 * DRAM_ACCESS_TIME * l2_err;
+    }
+    freeCaches();
+}
+
+// The prefetch ratios are 0 rather than NaN when a prefetcher never
+// prefetched or nothing missed
+static inline double ratioOrZero(uint64_t num, uint64_t den)
+{
+    return den ? static_cast<double>(num) / den : 0;
+}
+
+// Fill in the hit/miss ratios and AATs of st from its counters
+void Simulator::computeRatios(sim_stats_t *st) const
+{
+    st->read_hit_ratio_l2 = static_cast<double>(st->read_hits_l2) / st->reads_l2;
+    st->read_miss_ratio_l2 = static_cast<double>(st->read_misses_l2) / st->reads_l2;
+    st->prefetch_accuracy_l2 = ratioOrZero(st->useful_prefetches_l2, st->prefetches_l2);
+    st->prefetch_coverage_l2 = ratioOrZero(st->useful_prefetches_l2, st->useful_prefetches_l2 + st->read_misses_l2);
+    double Hit_Time_l2 = cacheHitTime(&L2->config);
+
+    if (L2->config.disabled)
+    {
+        st->avg_access_time_l2 = DRAM_ACCESS_TIME;
+    }
+    else
+    {
+        double below = num_levels > 2 ? outer_stats[0].avg_access_time : DRAM_ACCESS_TIME;
+        st->avg_access_time_l2 = Hit_Time_l2 + st->read_miss_ratio_l2 * below;
+    }
+    st->hit_ratio_l1 = static_cast<double>(st->hits_l1) / st->accesses_l1;
+    st->miss_ratio_l1 = static_cast<double>(st->misses_l1) / st->accesses_l1;
+    double Hit_Time_l1 = cacheHitTime(&L1->config);
+    /* if (L2->config.disabled)
+    {
+        st->avg_access_time_l1 = Hit_Time_l1 + st->miss_ratio_l1 * DRAM_ACCESS_TIME;
+    }
+    else
+    { */
+    st->avg_access_time_l1 = Hit_Time_l1 + st->miss_ratio_l1 * st->avg_access_time_l2;
+    /* } */
+    if (config.victim_entries)
+    {
+        // L1 misses that allocate probe the victim cache before L2
+        st->hit_ratio_vc = static_cast<double>(st->hits_vc) / (st->hits_vc + st->misses_vc);
+        double below_l1 = VICTIM_HIT_TIME + (1 - st->hit_ratio_vc) * st->avg_access_time_l2;
+        st->avg_access_time_l1 = Hit_Time_l1 + st->miss_ratio_l1 * below_l1;
+    }
+    if (!config.l1i_config.disabled)
+    {
+        st->hit_ratio_l1i = static_cast<double>(st->hits_l1i) / st->accesses_l1i;
+        st->miss_ratio_l1i = static_cast<double>(st->misses_l1i) / st->accesses_l1i;
+        st->avg_access_time_l1i = cacheHitTime(&config.l1i_config) + st->miss_ratio_l1i * st->avg_access_time_l2;
+    }
+}
+
+// Ratios of the levels below L2, from the last one (which misses to DRAM)
+// up, since each level's AAT needs the one below it
+void Simulator::computeLevelRatios()
+{
+    double below = DRAM_ACCESS_TIME;
+    for (uint64_t level = num_levels; level-- > 2;)
+    {
+        sim_level_stats_t *st = &outer_stats[level - 2];
+        st->read_hit_ratio = static_cast<double>(st->read_hits) / st->reads;
+        st->read_miss_ratio = static_cast<double>(st->read_misses) / st->reads;
+        st->avg_access_time = cacheHitTime(&outer[level - 2]->config) + st->read_miss_ratio * below;
+        st->prefetch_accuracy = ratioOrZero(st->useful_prefetches, st->prefetches);
+        st->prefetch_coverage = ratioOrZero(st->useful_prefetches, st->useful_prefetches + st->read_misses);
+        below = st->avg_access_time;
+    }
+}
+
+const sim_level_stats_t *Simulator::get_level_stats(uint64_t level) const
+{
+    return level >= 3 && level <= levelsOf(&config) ? &outer_stats[level - 3] : NULL;
+}
+
+// Work out the confidence intervals from the sampled groups, then scale
+// the counters of the sampled accesses up to the whole trace. Reads and
+// writes were counted for every access and are exact.
+void Simulator::finishSampling()
+{
+    uint64_t groups = 1UL << sample_bits;
+    sample_stats.groups = groups;
+    sample_stats.sampled_groups = 0;
+    for (uint64_t g = 0; g < groups; g++)
+    {
+        if (((g * SAMPLE_HASH_MUL) >> (64 - SAMPLE_HASH_BITS)) < sample_threshold)
+        {
+            sample_stats.sampled_groups++;
+        }
+    }
+    sample_stats.accesses = seen_reads + seen_writes;
+    sample_stats.sampled_accesses = stats.accesses_l1;
+    sample_stats.miss_ratio_l1_err = sampleRatioError(&sample_group::misses_l1, &sample_group::accesses_l1);
+    sample_stats.read_miss_ratio_l2_err = L2->config.disabled
+        ? NAN
+        : sampleRatioError(&sample_group::read_misses_l2, &sample_group::reads_l2);
+
+    double scale = stats.accesses_l1 ? static_cast<double>(sample_stats.accesses) / stats.accesses_l1 : 0;
+    stats.reads = seen_reads;
+    stats.writes = seen_writes;
+    stats.accesses_l1 = sample_stats.accesses;
+    stats.misses_l1 = llround(stats.misses_l1 * scale);
+    stats.hits_l1 = stats.accesses_l1 - stats.misses_l1;
+    stats.reads_l2 = llround(stats.reads_l2 * scale);
+    stats.read_misses_l2 = llround(stats.read_misses_l2 * scale);
+    stats.read_hits_l2 = stats.reads_l2 - stats.read_misses_l2;
+    stats.writes_l2 = llround(stats.writes_l2 * scale);
+    stats.accesses_l2 = llround(stats.accesses_l2 * scale);
+    stats.prefetches_l2 = llround(stats.prefetches_l2 * scale);
+    stats.writes_dram = llround(stats.writes_dram * scale);
+    stats.write_buffer_merges = llround(stats.write_buffer_merges * scale);
+    stats.useful_prefetches_l2 = llround(stats.useful_prefetches_l2 * scale);
+    stats.polluting_misses_l2 = llround(stats.polluting_misses_l2 * scale);
+}
+
+// Half width of the 95% confidence interval of the ratio sum(num)/sum(den)
+// over all groups, estimated from the sampled ones (ratio estimator with
+// finite population correction)
+double Simulator::sampleRatioError(uint64_t sample_group::*num, uint64_t sample_group::*den) const
+{
+    uint64_t groups = sample_stats.groups;
+    double m = sample_stats.sampled_groups;
+    double sum_num = 0;
+    double sum_den = 0;
+    for (uint64_t g = 0; g < groups; g++)
+    {
+        sum_num += sample_groups[g].*num;
+        sum_den += sample_groups[g].*den;
+    }
+    if (m < 2 || sum_den == 0)
+    {
+        return NAN;
+    }
+
+    // Unsampled groups are all zero and add nothing to the residuals
+    double ratio = sum_num / sum_den;
+    double mean_den = sum_den / m;
+    double residuals = 0;
+    for (uint64_t g = 0; g < groups; g++)
+    {
+        double r = sample_groups[g].*num - ratio * sample_groups[g].*den;
+        residuals += r * r;
+    }
+    double variance = (1 - m / groups) / (m * mean_den * mean_den) * residuals / (m - 1);
+    return SAMPLE_Z95 * sqrt(variance);
+}
+
+// Release the L1 and L2 tag stores, if any
+void Simulator::freeCaches()
+{
+    if (L1 == NULL)
+    {
+        return;
+    }
+
+    freeCache(L1);
+    freeCache(L2);
+    if (L1I != NULL)
+    {
+        freeCache(L1I);
+        free(L1I);
+        L1I = NULL;
+    }
+    freeVictimCache(&victims);
+    for (uint64_t level = 2; level < num_levels; level++)
+    {
+        freeCache(outer[level - 2]);
+        free(outer[level - 2]);
+    }
+    num_levels = 0;
+
+    // Finally, free L1 and L2 caches themselves
+    free(L1);
+    free(L2);
+    L1 = NULL;
+    L2 = NULL;
+    if (checkpoint_map == NULL)
+    {
+        free(sample_groups);
+    }
+    sample_groups = NULL;
+    releaseCheckpoint();
+}
+
+uint64_t getIndex(uint64_t addr, cache *cache)
+{
+    uint64_t block_offset_bits = cache->config.b;
+    // The index bits would directly follow the block offset bits in the address.
+    uint64_t index_bits = cache->config.c - cache->config.s - cache->config.b; // Correcting my explanation here
+    uint64_t mask = (1UL << index_bits) - 1;
+    uint64_t index = (addr >> block_offset_bits) & mask;
+    return index;
+}
+
+uint64_t getTag(uint64_t addr, cache *cache)
+{
+    uint64_t block_offset_bits = cache->config.b;
+    uint64_t index_bits = cache->config.c - cache->config.s - cache->config.b; // Assuming this directly gives index bits
+    // Shift right to remove both the block offset and index bits.
+    uint64_t tag = addr >> (block_offset_bits + index_bits);
+    return tag;
+}
+
+// Allocate the tag store of a cache in one block: the per-block arrays
+// (tags, frequencies), the valid and dirty bitmaps, then the LRU links and
+// LFU heaps. Links, heap positions and MRU ways start out as WAY_NIL (all
+// sets empty), everything else zeroed.
+// Geometry of the cache and the size of its tag store
+static size_t initCacheGeometry(cache *cache, const cache_config_t *config)
+{
+    cache->config = *config;
+    cache->timestamp_counter = 1UL << (config->c - config->b + 1);
+
+    cache->num_sets = 1UL << (config->c - config->b - config->s);
+    cache->num_ways = 1UL << config->s;
+    cache->flag_words = (cache->num_ways + 63) / 64;
+    cache->match_tags = selectTagMatch(cache->num_ways);
+    cache->storage = NULL;
+    return cacheStorageBytes(cache);
+}
+
+// Bytes of the flag bitmaps and tags, which start out zero, and of the
+// WAY_NIL filled part of the link arrays that follows them
+static void cacheStorageParts(const cache *cache, size_t *flag_bytes, size_t *nil_bytes)
+{
+    uint64_t num_blocks = cache->num_sets * cache->num_ways;
+    uint64_t num_flag_words = cache->num_sets * cache->flag_words;
+    *flag_bytes = (2 * num_blocks + 3 * num_flag_words) * sizeof(uint64_t);
+    *nil_bytes = (3 * num_blocks + 3 * cache->num_sets) * sizeof(uint32_t);
+}
+
+size_t cacheStorageBytes(const cache *cache)
+{
+    size_t flag_bytes;
+    size_t nil_bytes;
+    cacheStorageParts(cache, &flag_bytes, &nil_bytes);
+    uint64_t num_blocks = cache->num_sets * cache->num_ways;
+    size_t link_bytes = nil_bytes + (num_blocks + cache->num_sets) * sizeof(uint32_t);
+    return (flag_bytes + link_bytes + 63) & ~(size_t)63;
+}
+
+double cacheHitTime(const cache_config_t *config)
+{
+    const hit_time_model_t *model = &config->hit_time;
+    return model->base + model->per_index_bit * (config->c - config->b - config->s) +
+           model->per_way_bit * (std::max(3, (int)config->s) - 3);
+}
+
+prefetch_kind_t prefetchKindOf(const cache_config_t *config)
+{
+    if (config->prefetcher_disabled)
+    {
+        return PREFETCH_NONE;
+    }
+    if (config->prefetch_kind != PREFETCH_NONE)
+    {
+        return config->prefetch_kind;
+    }
+    return config->strided_prefetch_disabled ? PREFETCH_PLUS_ONE : PREFETCH_STRIDED;
+}
+
+// Point the arrays of the cache into storage, which holds
+// cacheStorageBytes() bytes
+static void layoutCache(cache *cache, void *storage)
+{
+    uint64_t num_blocks = cache->num_sets * cache->num_ways;
+    uint64_t num_flag_words = cache->num_sets * cache->flag_words;
+    cache->tags = (uint64_t *)storage;
+    cache->frequencies = cache->tags + num_blocks;
+    cache->valid_bits = cache->frequencies + num_blocks;
+    cache->dirty_bits = cache->valid_bits + num_flag_words;
+    cache->prefetched_bits = cache->dirty_bits + num_flag_words;
+    cache->lru_prev = (uint32_t *)(cache->prefetched_bits + num_flag_words);
+    cache->lru_next = cache->lru_prev + num_blocks;
+    cache->lfu_pos = cache->lru_next + num_blocks;
+    cache->lru_head = cache->lfu_pos + num_blocks;
+    cache->lru_tail = cache->lru_head + cache->num_sets;
+    cache->lfu_mru = cache->lru_tail + cache->num_sets;
+    cache->lfu_heap = cache->lfu_mru + cache->num_sets;
+    cache->lfu_size = cache->lfu_heap + num_blocks;
+}
+
+void initCache(cache *cache, const cache_config_t *config)
+{
+    size_t bytes = initCacheGeometry(cache, config);
+    size_t flag_bytes;
+    size_t nil_bytes;
+    cacheStorageParts(cache, &flag_bytes, &nil_bytes);
+
+    cache->storage = aligned_alloc(64, bytes);
+    memset(cache->storage, 0, bytes);
+    memset((char *)cache->storage + flag_bytes, 0xff, nil_bytes);
+    layoutCache(cache, cache->storage);
+}
+
+// Like initCache(), but over a tag store owned by the caller (e.g. a mapped
+// checkpoint) that already holds cacheStorageBytes() bytes of state
+void attachCache(cache *cache, const cache_config_t *config, void *storage)
+{
+    initCacheGeometry(cache, config);
+    layoutCache(cache, storage);
+}
+
+// A cache with its own copy of from's tag store, under config (which may
+// only differ from from's in ways that don't change the layout)
+void copyCache(cache *cache, const cache_t *from, const cache_config_t *config)
+{
+    size_t bytes = initCacheGeometry(cache, config);
+    cache->storage = aligned_alloc(64, bytes);
+    memcpy(cache->storage, from->tags, bytes);
+    layoutCache(cache, cache->storage);
+    cache->timestamp_counter = from->timestamp_counter;
+}
+
+void freeCache(cache *cache)
+{
+    free(cache->storage);
+    cache->storage = NULL;
+}
+
+// Hash slots of a victim cache: at least twice the entries, so probe runs
+// stay short
+static uint64_t victimSlotCount(uint64_t num_entries)
+{
+    uint64_t slots = 1;
+    while (slots < 2 * num_entries)
+    {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+size_t victimStorageBytes(uint64_t num_entries)
+{
+    uint64_t slots = victimSlotCount(num_entries);
+    size_t bytes = num_entries * sizeof(uint64_t) + (2 * num_entries + slots + 3) * sizeof(uint32_t) +
+                   num_entries * sizeof(uint8_t);
+    return (bytes + 63) & ~(size_t)63;
+}
+
+static void layoutVictimCache(victim_cache_t *victims, uint64_t num_entries, uint64_t b, void *storage)
+{
+    victims->num_entries = num_entries;
+    victims->b = b;
+    victims->slot_mask = victimSlotCount(num_entries) - 1;
+    victims->block_addrs = (uint64_t *)storage;
+    victims->prev = (uint32_t *)(victims->block_addrs + num_entries);
+    victims->next = victims->prev + num_entries;
+    victims->slots = victims->next + num_entries;
+    victims->ends = victims->slots + victims->slot_mask + 1;
+    victims->dirty = (uint8_t *)(victims->ends + 3);
+    victims->storage = NULL;
+}
+
+void initVictimCache(victim_cache_t *victims, uint64_t num_entries, uint64_t b)
+{
+    size_t bytes = victimStorageBytes(num_entries);
+    void *storage = aligned_alloc(64, bytes);
+    memset(storage, 0, bytes);
+    layoutVictimCache(victims, num_entries, b, storage);
+    victims->storage = storage;
+    memset(victims->slots, 0xff, (victims->slot_mask + 1) * sizeof(uint32_t));
+    for (uint64_t e = 0; e < num_entries; e++)
+    {
+        victims->next[e] = e + 1 < num_entries ? e + 1 : WAY_NIL;
+    }
+    victims->ends[0] = WAY_NIL;
+    victims->ends[1] = WAY_NIL;
+    victims->ends[2] = num_entries ? 0 : WAY_NIL;
+}
 
-                        uint64_t l2_target = isInCache('R', addr, stats, L2);
-                        // When the needed block is not in L2
-                        // It needs to select a block to put needed
-                        // block in at first
-                        // L2 miss
-                        if (l2_target == UINT64_MAX)
-                        {
-                            uint64_t l2_empty_block = findEmptyBlockIndex(L2, l2_index, l2_num_blocks);
+// Like attachCache(), over victimStorageBytes() bytes of saved state
+void attachVictimCache(victim_cache_t *victims, uint64_t num_entries, uint64_t b, void *storage)
+{
+    layoutVictimCache(victims, num_entries, b, storage);
+}
 
-#ifdef DEBUG
-                            printf("L2 read miss\n");
-#endif
+void copyVictimCache(victim_cache_t *victims, const victim_cache_t *from)
+{
+    size_t bytes = victimStorageBytes(from->num_entries);
+    void *storage = aligned_alloc(64, bytes);
+    memcpy(storage, from->block_addrs, bytes);
+    layoutVictimCache(victims, from->num_entries, from->b, storage);
+    victims->storage = storage;
+}
 
-                            // Still empty block in L2
-                            if (l2_empty_block != UINT64_MAX)
-                            {
-                                setTag(L2, l2_index, l2_empty_block, l2_tag);
-                                setValidBit(L2, l2_index, l2_empty_block);
-                                setMRUBitNewAndClearOther(L2, l2_index, l2_empty_block);
-                                L2->sets[l2_index].blocks[l2_empty_block].frequency = 1;
-                            }
-                            else
-                            {
-                                // LFU
-                                uint64_t l2_lfu_index = findLFUBlockIndex(&(L2->sets[l2_index]), l2_num_blocks);
-                                setTag(L2, l2_index, l2_lfu_index, l2_tag);
-                                setMRUBitNewAndClearOther(L2, l2_index, l2_lfu_index);
-                                L2->sets[l2_index].blocks[l2_lfu_index].frequency = 1;
+void freeVictimCache(victim_cache_t *victims)
+{
+    free(victims->storage);
+    memset(victims, 0, sizeof *victims);
+}
 
-#ifdef DEBUG
-                                printf("Evicted from L2: block with valid: %d index: 0x%lx\n",
-                                       0,
-                                       l2_index);
-#endif
-                            }
-                            prefetch(L2, addr, stats);
-                        }
-                        else // When the needed block is in L2
-                        {
-                            setMRUBitNewAndClearOther(L2, l2_index, l2_target);
-                            L2->sets[l2_index].blocks[l2_target].frequency++;
-#ifdef DEBUG
-                            printf("L2 read hit\n");
-#endif
-                        }
-                        // Then Add the needed block to L1
-                        if (getDirtyBit(L1, index, lfu_index))
-                        {
-                            uint64_t evicted_tag = L1->sets[index].blocks[lfu_index].tag;
-                            uint64_t l1_index_bits = (L1->config.c - L1->config.s - L1->config.b);
-                            uint64_t l1_offset_bits = (L1->config.b);
-                            uint64_t addr = (evicted_tag << (l1_index_bits + l1_offset_bits)) + (index << L1->config.b);
-                            uint64_t l2_tag = getTag(addr, L2);
-                            uint64_t l2_index = getIndex(addr, L2);
-                            uint64_t evicted_target_block = isInCache('W', addr, stats, L2);
-                            // Not in L2
-                            if (evicted_target_block == UINT64_MAX)
-                            {
-                            }
-                            else
-                            {
-                                setMRUBitNewAndClearOther(L2, l2_index, evicted_target_block);
-                                L2->sets[l2_index].blocks[evicted_target_block].frequency++;
-                            }
-                        }
-                        setTag(L1, index, lfu_index, tag);
-                        clearDirtyBit(L1, index, lfu_index);
-                        setMRUBitNewAndClearOther(L1, index, lfu_index);
-                        L1->sets[index].blocks[lfu_index].frequency = 1;
-
-                        /* if (l2_target == UINT64_MAX)
-                        {
-                            prefetch(L2, addr, stats);
-                        } */
-                    }
-#ifdef DEBUG
-                    printf("Evict from L1: block with valid=%d, dirty=%d, tag 0x%lx and index=0x%lx\n",
-                           L1->sets[index].blocks[lfu_index].valid_bit,
-                           L1->sets[index].blocks[lfu_index].dirty_bit,
-                           tag,
-                           index);
-#endif
-                }
-            }
-        }
-        else // Hit on cache
-        {
-#ifdef DEBUG
-            printf("L1 hit\n");
-#endif
+static inline uint64_t victimHome(const victim_cache_t *victims, uint64_t block_addr)
+{
+    return ((block_addr * SAMPLE_HASH_MUL) >> 32) & victims->slot_mask;
+}
 
-            if (rw == 'W')
-            {
-                setDirtyBit(L1, index, l1_target);
-                setMRUBitNewAndClearOther(L1, index, l1_target);
-                L1->sets[index].blocks[l1_target].frequency++;
-            }
-            if (rw == 'R')
-            {
-                setMRUBitNewAndClearOther(L1, index, l1_target);
-                L1->sets[index].blocks[l1_target].frequency++;
-            }
+// Hash slot holding block_addr's entry, or UINT64_MAX
+static uint64_t victimFind(const victim_cache_t *victims, uint64_t block_addr)
+{
+    uint64_t mask = victims->slot_mask;
+    for (uint64_t i = victimHome(victims, block_addr); victims->slots[i] != WAY_NIL; i = (i + 1) & mask)
+    {
+        if (victims->block_addrs[victims->slots[i]] == block_addr)
+        {
+            return i;
         }
     }
+    return UINT64_MAX;
 }
 
-/**
- * Subroutine for cleaning up any outstanding memory operations and calculating overall statistics
- * such as miss rate or average access time.
- * TODO: You're responsible for completing this routine
- */
-void sim_finish(sim_stats_t *stats)
+// Empty hash slot i, shifting later entries of its probe run back so that
+// lookups never stop short at the hole
+static void victimUnhash(victim_cache_t *victims, uint64_t i)
 {
-    uint64_t num_sets_L1 = 1UL << (L1->config.c - L1->config.b - L1->config.s);
-    uint64_t num_sets_L2 = 1UL << (L2->config.c - L2->config.b - L2->config.s);
-
-    stats->read_hit_ratio_l2 = static_cast<double>(stats->read_hits_l2) / stats->reads_l2;
-    stats->read_miss_ratio_l2 = static_cast<double>(stats->read_misses_l2) / stats->reads_l2;
-    double Hit_Time_l2 =
-        L2_HIT_K3 +
-        (L2_HIT_K4 * (L2->config.c - L2->config.b - L2->config.s)) +
-        L2_HIT_K5 * (std::max(3, (int)L2->config.s) - 3);
+    uint64_t mask = victims->slot_mask;
+    for (uint64_t j = (i + 1) & mask; victims->slots[j] != WAY_NIL; j = (j + 1) & mask)
+    {
+        uint64_t home = victimHome(victims, victims->block_addrs[victims->slots[j]]);
+        // Move it unless its home lies cyclically in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            victims->slots[i] = victims->slots[j];
+            i = j;
+        }
+    }
+    victims->slots[i] = WAY_NIL;
+}
 
-    if (L2->config.disabled)
+static void victimUnlink(victim_cache_t *victims, uint32_t e)
+{
+    uint32_t prev = victims->prev[e];
+    uint32_t next = victims->next[e];
+    if (prev != WAY_NIL)
     {
-        stats->avg_access_time_l2 = DRAM_ACCESS_TIME;
+        victims->next[prev] = next;
     }
     else
     {
-        stats->avg_access_time_l2 = Hit_Time_l2 + stats->read_miss_ratio_l2 * DRAM_ACCESS_TIME;
+        victims->ends[0] = next;
     }
-    stats->hit_ratio_l1 = static_cast<double>(stats->hits_l1) / stats->accesses_l1;
-    stats->miss_ratio_l1 = static_cast<double>(stats->misses_l1) / stats->accesses_l1;
-    double Hit_Time_l1 =
-        L1_HIT_K0 +
-        (L1_HIT_K1 * (L1->config.c - L1->config.b - L1->config.s)) +
-        L1_HIT_K2 * (std::max(3, (int)L1->config.s) - 3);
-    /* if (L2->config.disabled)
+    if (next != WAY_NIL)
     {
-        stats->avg_access_time_l1 = Hit_Time_l1 + stats->miss_ratio_l1 * DRAM_ACCESS_TIME;
+        victims->prev[next] = prev;
     }
     else
-    { */
-    stats->avg_access_time_l1 = Hit_Time_l1 + stats->miss_ratio_l1 * stats->avg_access_time_l2;
-    /* } */
-    // Free L1 blocks and sets
-    for (uint64_t i = 0; i < num_sets_L1; ++i)
     {
-        free(L1->sets[i].blocks);
+        victims->ends[1] = prev;
     }
-    free(L1->sets);
+}
 
-    // Free L2 blocks and sets
-    for (uint64_t i = 0; i < num_sets_L2; ++i)
+static void victimPushMRU(victim_cache_t *victims, uint32_t e)
+{
+    victims->prev[e] = WAY_NIL;
+    victims->next[e] = victims->ends[0];
+    if (victims->ends[0] != WAY_NIL)
     {
-        free(L2->sets[i].blocks);
+        victims->prev[victims->ends[0]] = e;
     }
-    free(L2->sets);
+    else
+    {
+        victims->ends[1] = e;
+    }
+    victims->ends[0] = e;
+}
 
-    // Finally, free L1 and L2 caches themselves
-    free(L1);
-    free(L2);
+bool victimHolds(const victim_cache_t *victims, uint64_t addr)
+{
+    return victimFind(victims, addr >> victims->b) != UINT64_MAX;
 }
 
-uint64_t getIndex(uint64_t addr, cache *cache)
+// Remove addr's block, adding whether it was dirty to *dirty. Returns
+// whether it was there.
+bool victimTake(victim_cache_t *victims, uint64_t addr, bool *dirty)
 {
-    uint64_t block_offset_bits = cache->config.b;
-    // The index bits would directly follow the block offset bits in the address.
-    uint64_t index_bits = cache->config.c - cache->config.s - cache->config.b; // Correcting my explanation here
-    uint64_t mask = (1UL << index_bits) - 1;
-    uint64_t index = (addr >> block_offset_bits) & mask;
-    return index;
+    uint64_t i = victimFind(victims, addr >> victims->b);
+    if (i == UINT64_MAX)
+    {
+        return false;
+    }
+    uint32_t e = victims->slots[i];
+    *dirty |= victims->dirty[e] != 0;
+    victimUnhash(victims, i);
+    victimUnlink(victims, e);
+    victims->next[e] = victims->ends[2];
+    victims->ends[2] = e;
+    return true;
 }
 
-uint64_t getTag(uint64_t addr, cache *cache)
+// Insert addr's block as the MRU entry. When full, the LRU entry makes
+// room; returns whether it did, with its address and dirty bit.
+bool victimPut(victim_cache_t *victims, uint64_t addr, bool dirty, uint64_t *evicted_addr, bool *evicted_dirty)
 {
-    uint64_t block_offset_bits = cache->config.b;
-    uint64_t index_bits = cache->config.c - cache->config.s - cache->config.b; // Assuming this directly gives index bits
-    // Shift right to remove both the block offset and index bits.
-    uint64_t tag = addr >> (block_offset_bits + index_bits);
-    return tag;
+    uint64_t block_addr = addr >> victims->b;
+    uint64_t i = victimFind(victims, block_addr);
+    if (i != UINT64_MAX)
+    {
+        uint32_t e = victims->slots[i];
+        victims->dirty[e] |= dirty;
+        victimUnlink(victims, e);
+        victimPushMRU(victims, e);
+        return false;
+    }
+
+    bool evicted = victims->ends[2] == WAY_NIL;
+    uint32_t e;
+    if (evicted)
+    {
+        e = victims->ends[1];
+        *evicted_addr = victims->block_addrs[e] << victims->b;
+        *evicted_dirty = victims->dirty[e] != 0;
+        victimUnhash(victims, victimFind(victims, victims->block_addrs[e]));
+        victimUnlink(victims, e);
+    }
+    else
+    {
+        e = victims->ends[2];
+        victims->ends[2] = victims->next[e];
+    }
+    victims->block_addrs[e] = block_addr;
+    victims->dirty[e] = dirty;
+    victimPushMRU(victims, e);
+    i = victimHome(victims, block_addr);
+    while (victims->slots[i] != WAY_NIL)
+    {
+        i = (i + 1) & victims->slot_mask;
+    }
+    victims->slots[i] = e;
+    return evicted;
 }
 
-bool getValidBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
+// Position of a block in the per-block arrays
+static inline uint64_t blockSlot(const cache *cache, uint64_t set_index, uint64_t block_index)
+{
+    return set_index * cache->num_ways + block_index;
+}
+
+// Word of a per-set bitmap holding the flag of a block
+static inline uint64_t *flagWord(const cache *cache, uint64_t *bits, uint64_t set_index, uint64_t block_index)
+{
+    return &bits[set_index * cache->flag_words + (block_index >> 6)];
+}
+
+static inline uint64_t flagMask(uint64_t block_index)
 {
+    return 1UL << (block_index & 63);
+}
 
-    return (cache->sets[set_index].blocks[block_index]).valid_bit ? true : false;
+bool getValidBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    return (*flagWord(cache, cache->valid_bits, set_index, block_index) & flagMask(block_index)) != 0;
 }
 
 void setValidBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
 {
-    cache->sets[set_index].blocks[block_index].valid_bit = 1;
+    *flagWord(cache, cache->valid_bits, set_index, block_index) |= flagMask(block_index);
 }
 
 void clearValidBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
 {
-    cache->sets[set_index].blocks[block_index].valid_bit = 0;
+    *flagWord(cache, cache->valid_bits, set_index, block_index) &= ~flagMask(block_index);
 }
 
 bool getDirtyBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
 {
-
-    return cache->sets[set_index].blocks[block_index].dirty_bit ? true : false;
+    return (*flagWord(cache, cache->dirty_bits, set_index, block_index) & flagMask(block_index)) != 0;
 }
 
 void setDirtyBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
 {
-    cache->sets[set_index].blocks[block_index].dirty_bit = 1;
+    *flagWord(cache, cache->dirty_bits, set_index, block_index) |= flagMask(block_index);
 }
 
 void clearDirtyBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
 {
-    cache->sets[set_index].blocks[block_index].dirty_bit = 0;
+    *flagWord(cache, cache->dirty_bits, set_index, block_index) &= ~flagMask(block_index);
 }
 
-void updateTimestamp(cache_t *cache, uint64_t set_index, uint64_t block_index)
+bool getPrefetchedBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
 {
-    cache->sets[set_index].blocks[block_index].timestamp = cache->timestamp_counter;
-    cache->timestamp_counter++;
+    return (*flagWord(cache, cache->prefetched_bits, set_index, block_index) & flagMask(block_index)) != 0;
+}
+
+void setPrefetchedBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    *flagWord(cache, cache->prefetched_bits, set_index, block_index) |= flagMask(block_index);
 }
 
-// Prefetch blockaddr according to target insertion type
-void prefetch(cache_t *cache, uint64_t addr, sim_stats_t *stats)
+void clearPrefetchedBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
 {
-    uint64_t num_blocks = 1UL << (cache->config.s);
-    uint64_t block_addr = blockAddrTrans(cache, addr);
+    *flagWord(cache, cache->prefetched_bits, set_index, block_index) &= ~flagMask(block_index);
+}
 
-    if (cache->config.replace_policy == REPLACE_POLICY_LRU)
+void clearMRUBit(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    if (cache->lfu_mru[set_index] == block_index)
     {
-        // Dealing with +1 prefetcher
-        if (!cache->config.prefetcher_disabled && cache->config.strided_prefetch_disabled)
-        {
+        cache->lfu_mru[set_index] = WAY_NIL;
+    }
+}
 
-            uint64_t new_block_addr = block_addr + (1UL << (cache->config.b));
+uint64_t getBlockTag(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    return cache->tags[blockSlot(cache, set_index, block_index)];
+}
 
-            uint64_t new_tag = getTag(new_block_addr, cache);
-            uint64_t new_index = getIndex(new_block_addr, cache);
-            uint64_t target_block_index = prefetchInCache(cache, new_block_addr);
-            if (cache->config.prefetch_insert_policy == INSERT_POLICY_MIP)
-            {
-                // Prefetched block is not in L2 cache
-                // Need to find the LRU or LFU position
-                // Then insert into that position and update timestamp
-                if (target_block_index == UINT64_MAX)
-                {
-                    stats->prefetches_l2++;
-                    uint64_t empty_block = findEmptyBlockIndex(cache, new_index, num_blocks);
-                    if (empty_block == UINT64_MAX)
-                    {
-                        uint64_t lru_index = findLRUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        setTag(cache, new_index, lru_index, new_tag);
-                        updateTimestamp(cache, new_index, lru_index);
-                    }
-                    else
-                    {
-                        setTag(cache, new_index, empty_block, new_tag);
-                        setValidBit(cache, new_index, empty_block);
-                        updateTimestamp(cache, new_index, empty_block);
-                    }
-                }
-            }
-            if (cache->config.prefetch_insert_policy == INSERT_POLICY_LIP)
-            {
-                // Prefetched block is not in L2 cache
-                // Need to find the LRU or LFU position
-                // Then insert into that position and update timestamp
-                if (target_block_index == UINT64_MAX)
-                {
-                    stats->prefetches_l2++;
-                    uint64_t empty_block = findEmptyBlockIndex(cache, new_index, num_blocks);
-                    // No empty block now in L2
-                    if (empty_block == UINT64_MAX)
-                    {
-
-                        uint64_t lru_index = findLRUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        clearValidBit(cache, new_index, lru_index);
-                        uint64_t lowest_block = findLRUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        setValidBit(cache, new_index, lru_index);
-                        setTag(cache, new_index, lru_index, new_tag);
-                        cache->sets[new_index].blocks[lru_index].timestamp = cache->sets[new_index].blocks[lowest_block].timestamp - 1;
-                        cache->timestamp_counter++;
-                    }
-                    // Empty block exists
-                    else
-                    {
-                        if (checkAllEmpty(cache, new_index))
-                        {
-                            setTag(cache, new_index, empty_block, new_tag);
-                            setValidBit(cache, new_index, empty_block);
-                            cache->sets[new_index].blocks[empty_block].timestamp = cache->timestamp_counter;
-                            cache->timestamp_counter++;
-                        }
-                        else
-                        {
-                            uint64_t lowest_block = findLRUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                            setTag(cache, new_index, empty_block, new_tag);
-                            setValidBit(cache, new_index, empty_block);
-                            cache->sets[new_index].blocks[empty_block].timestamp = cache->sets[new_index].blocks[lowest_block].timestamp - 1;
-                            cache->timestamp_counter++;
-                        }
-                    }
-                }
-            }
+// LFU heap order: lower frequency first, then the smaller tag
+static inline bool lfuBefore(const cache_t *cache, uint64_t set_index, uint32_t a, uint32_t b)
+{
+    uint64_t slot_a = blockSlot(cache, set_index, a);
+    uint64_t slot_b = blockSlot(cache, set_index, b);
+    if (cache->frequencies[slot_a] != cache->frequencies[slot_b])
+    {
+        return cache->frequencies[slot_a] < cache->frequencies[slot_b];
+    }
+    return cache->tags[slot_a] < cache->tags[slot_b];
+}
+
+static inline void lfuPlace(cache_t *cache, uint64_t set_index, uint32_t pos, uint32_t way)
+{
+    cache->lfu_heap[blockSlot(cache, set_index, pos)] = way;
+    cache->lfu_pos[blockSlot(cache, set_index, way)] = pos;
+}
+
+// Restore the heap order around a way whose frequency or tag just changed,
+// adding it to the heap if it is not there yet
+static void lfuFix(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    uint32_t *heap = &cache->lfu_heap[blockSlot(cache, set_index, 0)];
+    uint32_t size = cache->lfu_size[set_index];
+    uint32_t way = block_index;
+    uint32_t pos = cache->lfu_pos[blockSlot(cache, set_index, way)];
+
+    if (pos == WAY_NIL)
+    {
+        pos = size++;
+        cache->lfu_size[set_index] = size;
+    }
+    while (pos > 0 && lfuBefore(cache, set_index, way, heap[(pos - 1) / 2]))
+    {
+        lfuPlace(cache, set_index, pos, heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    for (;;)
+    {
+        uint32_t child = 2 * pos + 1;
+        if (child >= size)
+        {
+            break;
         }
-        // Dealing with strided prefetcher
-        if (!cache->config.prefetcher_disabled && !cache->config.strided_prefetch_disabled)
+        if (child + 1 < size && lfuBefore(cache, set_index, heap[child + 1], heap[child]))
         {
-            uint64_t k = (block_addr - prev_block_addr);
-            uint64_t new_block_addr = block_addr + k;
-#ifdef DEBUG
-            printf("Old block addr: 0x%lx, Prev block addr: 0x%lx, New block addr: 0x%lx\n", block_addr, prev_block_addr, new_block_addr);
-#endif
-            uint64_t new_tag = getTag(new_block_addr, cache);
-            uint64_t new_index = getIndex(new_block_addr, cache);
-            uint64_t target_block_index = prefetchInCache(cache, new_block_addr);
-            if (cache->config.prefetch_insert_policy == INSERT_POLICY_MIP)
-            {
-                // Prefetched block is not in L2 cache
-                // Need to find the LRU or LFU position
-                // Then insert into that position and update timestamp
-                if (target_block_index == UINT64_MAX)
-                {
-                    stats->prefetches_l2++;
-                    uint64_t empty_block = findEmptyBlockIndex(cache, new_index, num_blocks);
-                    if (empty_block == UINT64_MAX)
-                    {
-                        uint64_t lru_index = findLRUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        setTag(cache, new_index, lru_index, new_tag);
-                        updateTimestamp(cache, new_index, lru_index);
-                    }
-                    else
-                    {
-                        setTag(cache, new_index, empty_block, new_tag);
-                        setValidBit(cache, new_index, empty_block);
-                        updateTimestamp(cache, new_index, empty_block);
-                    }
-                }
-            }
-            if (cache->config.prefetch_insert_policy == INSERT_POLICY_LIP)
-            {
-                // Prefetched block is not in L2 cache
-                // Need to find the LRU or LFU position
-                // Then insert into that position and update timestamp
-                if (target_block_index == UINT64_MAX)
-                {
-                    stats->prefetches_l2++;
-                    uint64_t empty_block = findEmptyBlockIndex(cache, new_index, num_blocks);
-                    // No empty block now in L2
-                    if (empty_block == UINT64_MAX)
-                    {
-
-                        uint64_t lru_index = findLRUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        clearValidBit(cache, new_index, lru_index);
-                        uint64_t lowest_block = findLRUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        setValidBit(cache, new_index, lru_index);
-                        setTag(cache, new_index, lru_index, new_tag);
-                        cache->sets[new_index].blocks[lru_index].timestamp = cache->sets[new_index].blocks[lowest_block].timestamp - 1;
-                        cache->timestamp_counter++;
-                    }
-                    // Empty block exists
-                    else
-                    {
-                        if (checkAllEmpty(cache, new_index))
-                        {
-                            setTag(cache, new_index, empty_block, new_tag);
-                            setValidBit(cache, new_index, empty_block);
-                            cache->sets[new_index].blocks[empty_block].timestamp = cache->timestamp_counter;
-                            cache->timestamp_counter++;
-                        }
-                        else
-                        {
-                            uint64_t lowest_block = findLRUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                            setTag(cache, new_index, empty_block, new_tag);
-                            setValidBit(cache, new_index, empty_block);
-                            cache->sets[new_index].blocks[empty_block].timestamp = cache->sets[new_index].blocks[lowest_block].timestamp - 1;
-                            cache->timestamp_counter++;
-                        }
-                    }
-                }
-            }
-            prev_block_addr = block_addr;
+            child++;
+        }
+        if (!lfuBefore(cache, set_index, heap[child], way))
+        {
+            break;
         }
+        lfuPlace(cache, set_index, pos, heap[child]);
+        pos = child;
+    }
+    lfuPlace(cache, set_index, pos, way);
+}
+
+// Frequency updates also re-sort the block in the LFU heap. They follow
+// setTag on every fill, so they cover tag changes as well.
+void setFrequency(cache_t *cache, uint64_t set_index, uint64_t block_index, uint64_t frequency)
+{
+    cache->frequencies[blockSlot(cache, set_index, block_index)] = frequency;
+    lfuFix(cache, set_index, block_index);
+}
+
+void incrementFrequency(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    cache->frequencies[blockSlot(cache, set_index, block_index)]++;
+    lfuFix(cache, set_index, block_index);
+}
+
+// Take a block out of its set's LRU list if it is linked in
+static void lruUnlink(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    uint64_t slot = blockSlot(cache, set_index, block_index);
+    uint32_t prev = cache->lru_prev[slot];
+    uint32_t next = cache->lru_next[slot];
+
+    if (prev == WAY_NIL && cache->lru_head[set_index] != block_index)
+    {
+        return;
     }
-    if (cache->config.replace_policy == REPLACE_POLICY_LFU)
+    if (prev == WAY_NIL)
     {
-        // Dealing with +1 prefetcher
-        if (!cache->config.prefetcher_disabled && cache->config.strided_prefetch_disabled)
-        {
+        cache->lru_head[set_index] = next;
+    }
+    else
+    {
+        cache->lru_next[blockSlot(cache, set_index, prev)] = next;
+    }
+    if (next == WAY_NIL)
+    {
+        cache->lru_tail[set_index] = prev;
+    }
+    else
+    {
+        cache->lru_prev[blockSlot(cache, set_index, next)] = prev;
+    }
+    cache->lru_prev[slot] = WAY_NIL;
+    cache->lru_next[slot] = WAY_NIL;
+}
 
-            uint64_t new_block_addr = block_addr + (1UL << (cache->config.b));
+// Make a block the most recently used of its set (a hit or MIP insertion)
+void moveToMRU(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    lruUnlink(cache, set_index, block_index);
+    uint64_t slot = blockSlot(cache, set_index, block_index);
+    uint32_t head = cache->lru_head[set_index];
 
-            uint64_t new_tag = getTag(new_block_addr, cache);
-            uint64_t new_index = getIndex(new_block_addr, cache);
-            uint64_t target_block_index = prefetchInCache(cache, new_block_addr);
-            if (cache->config.prefetch_insert_policy == INSERT_POLICY_MIP)
-            {
-                // Prefetched block is not in L2 cache
-                // Need to find the LRU or LFU position
-                // Then insert into that position and update timestamp
-                if (target_block_index == UINT64_MAX)
-                {
-                    stats->prefetches_l2++;
-                    uint64_t empty_block = findEmptyBlockIndex(cache, new_index, num_blocks);
-                    if (empty_block == UINT64_MAX)
-                    {
-                        uint64_t lfu_index = findLFUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        setTag(cache, new_index, lfu_index, new_tag);
-                        setMRUBitNewAndClearOther(cache, new_index, lfu_index);
-                        cache->sets[new_index].blocks[lfu_index].frequency = 0;
-                    }
-                    else
-                    {
-                        setTag(cache, new_index, empty_block, new_tag);
-                        setValidBit(cache, new_index, empty_block);
-                        setMRUBitNewAndClearOther(cache, new_index, empty_block);
-                        cache->sets[new_index].blocks[empty_block].frequency = 0;
-                    }
-                }
-            }
-            if (cache->config.prefetch_insert_policy == INSERT_POLICY_LIP)
-            {
-                // Prefetched block is not in L2 cache
-                // Need to find the LRU or LFU position
-                // Then insert into that position and update timestamp
-                if (target_block_index == UINT64_MAX)
-                {
-                    stats->prefetches_l2++;
-                    uint64_t empty_block = findEmptyBlockIndex(cache, new_index, num_blocks);
-                    // No empty block now in L2
-                    if (empty_block == UINT64_MAX)
-                    {
-                        uint64_t lfu_index = findLFUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        setTag(cache, new_index, lfu_index, new_tag);
-                        cache->sets[new_index].blocks[lfu_index].MRU_bit = false;
-                        cache->sets[new_index].blocks[lfu_index].frequency = 0;
-                    }
-                    // Empty block exists
-                    else
-                    {
-                        setTag(cache, new_index, empty_block, new_tag);
-                        setValidBit(cache, new_index, empty_block);
-                        cache->sets[new_index].blocks[empty_block].MRU_bit = false;
-                        cache->sets[new_index].blocks[empty_block].frequency = 0;
-                    }
-                }
-            }
-        }
-        // Dealing with strided prefetcher
-        if (!cache->config.prefetcher_disabled && !cache->config.strided_prefetch_disabled)
-        {
-            uint64_t k = (block_addr - prev_block_addr);
-            uint64_t new_block_addr = block_addr + k;
+    cache->lru_next[slot] = head;
+    if (head == WAY_NIL)
+    {
+        cache->lru_tail[set_index] = block_index;
+    }
+    else
+    {
+        cache->lru_prev[blockSlot(cache, set_index, head)] = block_index;
+    }
+    cache->lru_head[set_index] = block_index;
+    cache->timestamp_counter++;
+}
 
-            uint64_t new_tag = getTag(new_block_addr, cache);
-            uint64_t new_index = getIndex(new_block_addr, cache);
-            uint64_t target_block_index = prefetchInCache(cache, new_block_addr);
-            if (cache->config.prefetch_insert_policy == INSERT_POLICY_MIP)
-            {
-                // Prefetched block is not in L2 cache
-                // Need to find the LRU or LFU position
-                // Then insert into that position and update timestamp
-                if (target_block_index == UINT64_MAX)
-                {
-                    stats->prefetches_l2++;
-                    uint64_t empty_block = findEmptyBlockIndex(cache, new_index, num_blocks);
-                    if (empty_block == UINT64_MAX)
-                    {
-                        uint64_t lfu_index = findLFUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        setTag(cache, new_index, lfu_index, new_tag);
-                        setMRUBitNewAndClearOther(cache, new_index, lfu_index);
-                        cache->sets[new_index].blocks[lfu_index].frequency = 0;
-                    }
-                    else
-                    {
-                        setTag(cache, new_index, empty_block, new_tag);
-                        setValidBit(cache, new_index, empty_block);
-                        setMRUBitNewAndClearOther(cache, new_index, empty_block);
-                        cache->sets[new_index].blocks[empty_block].frequency = 0;
-                    }
-                }
-            }
-            if (cache->config.prefetch_insert_policy == INSERT_POLICY_LIP)
-            {
-                // Prefetched block is not in L2 cache
-                // Need to find the LRU or LFU position
-                // Then insert into that position and update timestamp
-                if (target_block_index == UINT64_MAX)
-                {
+// Make a block the least recently used of its set (LIP insertion)
+void insertAtLRU(cache_t *cache, uint64_t set_index, uint64_t block_index)
+{
+    lruUnlink(cache, set_index, block_index);
+    uint64_t slot = blockSlot(cache, set_index, block_index);
+    uint32_t tail = cache->lru_tail[set_index];
+
+    cache->lru_prev[slot] = tail;
+    if (tail == WAY_NIL)
+    {
+        cache->lru_head[set_index] = block_index;
+    }
+    else
+    {
+        cache->lru_next[blockSlot(cache, set_index, tail)] = block_index;
+    }
+    cache->lru_tail[set_index] = block_index;
+    cache->timestamp_counter++;
+}
+
+// Prefetch into L2 after an L2 read miss on addr: the next block (+1) or
+// the block one stride further (strided, stride taken from the previous
+// miss). The block is placed with the L2 insertion policy unless it is
+// already present.
+template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, class Geometry>
+inline void Simulator::prefetchWith(uint64_t addr, sim_stats_t &st)
+{
+    if (Prefetch == PREFETCH_NONE)
+    {
+        return;
+    }
+
+    uint64_t block_addr = Geometry::blockAddr(L2, addr);
+    uint64_t new_block_addr;
+    if (Prefetch == PREFETCH_PLUS_ONE)
+    {
+        new_block_addr = block_addr + (1UL << (L2->config.b));
+    }
+    else
+    {
+        uint64_t k = (block_addr - prefetchers[0].prev_block_addr);
+        new_block_addr = block_addr + k;
 #ifdef DEBUG
-                    printf("Prefetch block with address 0x%lx from memrory to L2\n", new_block_addr);
+        printf("Old block addr: 0x%lx, Prev block addr: 0x%lx, New block addr: 0x%lx\n", block_addr, prefetchers[0].prev_block_addr, new_block_addr);
 #endif
-                    stats->prefetches_l2++;
-                    uint64_t empty_block = findEmptyBlockIndex(cache, new_index, num_blocks);
-                    // No empty block now in L2
-                    if (empty_block == UINT64_MAX)
-                    {
-                        uint64_t lfu_index = findLFUBlockIndex(&(cache->sets[new_index]), num_blocks);
-                        setTag(cache, new_index, lfu_index, new_tag);
-                        cache->sets[new_index].blocks[lfu_index].MRU_bit = false;
-                        cache->sets[new_index].blocks[lfu_index].frequency = 0;
-                    }
-                    // Empty block exists
-                    else
-                    {
-                        setTag(cache, new_index, empty_block, new_tag);
-                        setValidBit(cache, new_index, empty_block);
-                        cache->sets[new_index].blocks[empty_block].MRU_bit = false;
-                        cache->sets[new_index].blocks[empty_block].frequency = 0;
-                    }
-                }
-            }
-            prev_block_addr = block_addr;
+    }
+
+    uint64_t new_tag = Geometry::tag(L2, new_block_addr);
+    uint64_t new_index = Geometry::index(L2, new_block_addr);
+    if (Geometry::lookup(L2, new_index, new_tag) == UINT64_MAX)
+    {
+#ifdef DEBUG
+        printf("Prefetch block with address 0x%lx from memrory to L2\n", new_block_addr);
+#endif
+        st.prefetches_l2++;
+        uint64_t block = findEmptyBlockIndex(L2, new_index, Geometry::ways(L2));
+        if (block == UINT64_MAX)
+        {
+            block = Policy::victim(L2, new_index);
         }
+        setTag(L2, new_index, block, new_tag);
+        setValidBit(L2, new_index, block);
+        Policy::prefetchFill(L2, new_index, block, Insert);
+    }
+
+    if (Prefetch == PREFETCH_STRIDED)
+    {
+        prefetchers[0].prev_block_addr = block_addr;
     }
 }
 
 // Set the tag of certain block
 void setTag(cache *cache, uint64_t set_index, uint64_t block_index, uint64_t tag)
 {
-    cache->sets[set_index].blocks[block_index].tag = tag;
+    cache->tags[blockSlot(cache, set_index, block_index)] = tag;
 }
 
-// When you need to evict a block due to a cache miss, find the block with the smallest timestamp
-uint64_t findLRUBlockIndex(set *cache_set, uint64_t set_size)
+// When you need to evict a block due to a cache miss, take the LRU end of the set
+uint64_t findLRUBlockIndex(cache *cache, uint64_t set_index, uint64_t set_size)
 {
-    uint64_t lru_index = 0;
-    uint64_t lowest_timestamp = UINT64_MAX;
-    for (uint64_t i = 0; i < set_size; i++)
-    {
-        if (cache_set->blocks[i].timestamp < lowest_timestamp && cache_set->blocks[i].valid_bit)
-        {
-            lru_index = i;
-            lowest_timestamp = cache_set->blocks[i].timestamp;
-        }
-    }
-    return lru_index;
+    uint32_t tail = cache->lru_tail[set_index];
+    return tail == WAY_NIL ? 0 : tail;
 }
 
 // return the empty block index or UINT64_MAX otherwise
 uint64_t findEmptyBlockIndex(cache *cache, uint64_t set_index, uint64_t set_size)
 {
-    for (uint64_t i = 0; i < set_size; i++)
+    const uint64_t *valid = flagWord(cache, cache->valid_bits, set_index, 0);
+    for (uint64_t w = 0; w * 64 < set_size; w++)
     {
-        if (!cache->sets[set_index].blocks[i].valid_bit)
+        uint64_t empty = ~valid[w];
+        if (set_size - w * 64 < 64)
         {
-            return i;
+            empty &= (1UL << (set_size - w * 64)) - 1;
         }
-    }
-    return UINT64_MAX;
-}
-
-// Find the largest timestamp within a set
-uint64_t findMRUBlockIndex(set *cache_set, uint64_t set_size)
-{
-    uint64_t mru_index = 0;
-    uint64_t largest_timestamp = 0;
-    for (uint64_t i = 0; i < set_size; i++)
-    {
-        if (cache_set->blocks[i].timestamp > largest_timestamp && cache_set->blocks[i].valid_bit)
+        if (empty)
         {
-            mru_index = i;
-            largest_timestamp = cache_set->blocks[i].timestamp;
+            return w * 64 + __builtin_ctzll(empty);
         }
     }
-    return mru_index;
+    return UINT64_MAX;
 }
 
-uint64_t findTargetBlockIndex(set *cache_set, uint64_t set_size, uint64_t tag)
+// Return the first valid block of the set holding tag, or UINT64_MAX.
+// Compares up to 64 ways at a time with the tag-match kernel and masks the
+// result with the valid bitmap.
+uint64_t findValidBlockIndex(cache *cache, uint64_t set_index, uint64_t tag)
 {
-    uint64_t target_index = 0;
+    const uint64_t *tags = &cache->tags[blockSlot(cache, set_index, 0)];
+    const uint64_t *valid = flagWord(cache, cache->valid_bits, set_index, 0);
 
-    for (uint64_t i = 0; i < set_size; i++)
+    for (uint64_t w = 0; w < cache->flag_words; w++)
     {
-        if (cache_set->blocks[i].tag == tag)
+        uint64_t base = w * 64;
+        uint64_t ways = cache->num_ways - base < 64 ? cache->num_ways - base : 64;
+        uint64_t hits = cache->match_tags(tags + base, ways, tag) & valid[w];
+        if (hits)
         {
-            target_index = i;
-            break;
+            return base + __builtin_ctzll(hits);
         }
     }
-    return target_index;
+    return UINT64_MAX;
 }
 
 // Determine whether a certian address is in cache L1 or L2
 // Return the block index for a hit and UINT64_MAX for a miss
-uint64_t isInCache(char rw, uint64_t addr, sim_stats_t *stats, cache *cache)
+template <class Geometry>
+inline uint64_t Simulator::isInCache(char rw, uint64_t tag, uint64_t index, cache *cache, sim_stats_t &st)
 {
-    uint64_t tag = getTag(addr, cache);
-    uint64_t index = getIndex(addr, cache);
-    uint64_t num_blocks = 1UL << (cache->config.s);
-
     if (cache == L1)
     {
-        stats->accesses_l1++;
+        st.accesses_l1++;
         if (rw == 'W')
         {
-            stats->writes++;
+            st.writes++;
         }
         else
         {
-            stats->reads++;
+            st.reads++;
         }
-        for (uint64_t i = 0; i < num_blocks; i++)
+        uint64_t i = Geometry::lookup(cache, index, tag);
+        if (i != UINT64_MAX)
         {
-            if (cache->sets[index].blocks[i].tag == tag && getValidBit(cache, index, i))
-            {
-                stats->hits_l1++;
-                return i;
-            }
+            st.hits_l1++;
+            return i;
         }
-        stats->misses_l1++;
+        st.misses_l1++;
         return UINT64_MAX;
     }
     if (cache == L2)
     {
 
-        stats->accesses_l2++;
+        st.accesses_l2++;
         if (rw == 'R')
         {
-            stats->reads_l2++;
-            for (uint64_t i = 0; i < num_blocks; i++)
+            st.reads_l2++;
+            uint64_t i = Geometry::lookup(cache, index, tag);
+            if (i != UINT64_MAX)
             {
-                if (cache->sets[index].blocks[i].tag == tag && getValidBit(cache, index, i))
-                {
-                    stats->read_hits_l2++;
-                    return i;
-                }
+                st.read_hits_l2++;
+                return i;
             }
-            stats->read_misses_l2++;
+            st.read_misses_l2++;
             return UINT64_MAX;
         }
         if (rw == 'W')
         {
-            stats->writes_l2++;
-            for (uint64_t i = 0; i < num_blocks; i++)
-            {
-                if (cache->sets[index].blocks[i].tag == tag && getValidBit(cache, index, i))
-                {
-                    return i;
-                }
-            }
-            return UINT64_MAX;
-        }
-    }
-}
-
-// Return the target_block_index of that block_addr
-// Otherwise return UINT64_MAX
-uint64_t prefetchInCache(cache *cache, uint64_t new_block_addr)
-{
-    uint64_t index = getIndex(new_block_addr, cache);
-    uint64_t tag = getTag(new_block_addr, cache);
-    uint64_t num_blocks = 1UL << cache->config.s;
-    for (uint64_t i = 0; i < num_blocks; i++)
-    {
-        if (cache->sets[index].blocks[i].tag == tag && getValidBit(cache, index, i))
-        {
-            return i;
+            st.writes_l2++;
+            return Geometry::lookup(cache, index, tag);
         }
     }
     return UINT64_MAX;
 }
 
-// Return true if the set is all empty
-// Return false if it is not
-bool checkAllEmpty(cache *cache, uint64_t set_index)
-{
-    uint64_t num_blocks = 1UL << (cache->config.s);
-    for (uint64_t i = 0; i < num_blocks; i++)
-    {
-        if (cache->sets[set_index].blocks[i].valid_bit)
-        {
-            return false;
-        }
-    }
-    return true;
-}
-
 // Transfer into block_addr and ignore the offset
 uint64_t blockAddrTrans(cache *cache, uint64_t addr)
 {
@@ -1469,39 +2508,33 @@ uint64_t blockAddrTrans(cache *cache, uint64_t addr)
 
 void setMRUBitNewAndClearOther(cache *cache, uint64_t set_index, uint64_t block_index)
 {
-    uint64_t num_blocks = 1UL << cache->config.s;
-    for (uint64_t i = 0; i < num_blocks; i++)
-    {
-        cache->sets[set_index].blocks[i].MRU_bit = false;
-    }
-    cache->sets[set_index].blocks[block_index].MRU_bit = true;
-    return;
+    cache->lfu_mru[set_index] = block_index;
 }
 
-uint64_t findLFUBlockIndex(set *cache_set, uint64_t set_size)
+uint64_t findLFUBlockIndex(cache *cache, uint64_t set_index, uint64_t set_size)
 {
-    uint64_t lfu_index = UINT64_MAX; // Initialize to an invalid value
-    uint64_t lowest_frequency = UINT64_MAX;
-    uint64_t smallest_tag = UINT64_MAX;
+    // The heap top is the least frequently used block. If that is the MRU
+    // block, the next one in (frequency, tag) order is one of its children.
+    const uint32_t *heap = &cache->lfu_heap[blockSlot(cache, set_index, 0)];
+    uint32_t size = cache->lfu_size[set_index];
+    uint32_t mru = cache->lfu_mru[set_index];
 
-    for (uint64_t i = 0; i < set_size; i++)
+    if (size == 0)
     {
-
-        if (cache_set->blocks[i].frequency < lowest_frequency && !cache_set->blocks[i].MRU_bit && cache_set->blocks[i].valid_bit)
-        {
-            lowest_frequency = cache_set->blocks[i].frequency;
-        }
+        return 0;
     }
-    for (uint64_t i = 0; i < set_size; i++)
+    if (heap[0] != mru)
     {
-        if (cache_set->blocks[i].frequency == lowest_frequency &&
-            !cache_set->blocks[i].MRU_bit &&
-            cache_set->blocks[i].valid_bit &&
-            cache_set->blocks[i].tag < smallest_tag)
-        {
-            lfu_index = i;
-            smallest_tag = cache_set->blocks[i].tag;
-        }
+        return heap[0];
+    }
+    // A direct-mapped set only holds the MRU block, which is then the victim
+    if (size == 1)
+    {
+        return 0;
+    }
+    if (size == 2 || lfuBefore(cache, set_index, heap[1], heap[2]))
+    {
+        return heap[1];
     }
-    return lfu_index;
+    return heap[2];
 }
@@ -10,6 +10,8 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include "cachesim_simd.hpp"
+#include "cachesim_prefetch.hpp"
 #include <algorithm>
 
 typedef enum replace_policy
@@ -32,8 +34,32 @@ typedef enum write_strat
     WRITE_STRAT_WBWA,
     // Write through, write-no-allocate
     WRITE_STRAT_WTWNA,
+    // Write back, write-no-allocate: write misses go to the level below
+    WRITE_STRAT_WBWNA,
+    // Write through, write-allocate
+    WRITE_STRAT_WTWA,
 } write_strat_t;
 
+// How a level relates to the levels above it
+typedef enum inclusion_policy
+{
+    // Non-inclusive, non-exclusive: no constraint
+    INCLUSION_NINE,
+    // Holds every block above; its evictions back-invalidate them
+    INCLUSION_INCLUSIVE,
+    // Holds no block above: victims from above move in, hits move up
+    INCLUSION_EXCLUSIVE,
+} inclusion_policy_t;
+
+// Hit time in cycles of a cache with (C,B,S):
+// base + per_index_bit * (C - B - S) + per_way_bit * (max(3, S) - 3)
+typedef struct hit_time_model
+{
+    double base;
+    double per_index_bit;
+    double per_way_bit;
+} hit_time_model_t;
+
 typedef struct cache_config
 {
     bool disabled;
@@ -46,37 +72,115 @@ typedef struct cache_config
     replace_policy_t replace_policy;
     insert_policy_t prefetch_insert_policy;
     write_strat_t write_strat;
+    hit_time_model_t hit_time;
+    inclusion_policy_t inclusion;
+    // One of the table-driven prefetchers (PREFETCH_STREAM and up), or
+    // PREFETCH_NONE to let the two flags above pick none, +1 or strided
+    prefetch_kind_t prefetch_kind;
+    // Blocks prefetched per miss, and how far ahead the first one is
+    uint64_t prefetch_degree;
+    uint64_t prefetch_distance;
 } cache_config_t;
 
-// info about block including
-// tag, valid bit, dirty bit,
-// timestamp
-typedef struct block_t
-{
-    uint64_t tag;
-    bool valid_bit;
-    bool dirty_bit;
-    uint64_t timestamp; // last access timestamp
-    uint64_t frequency; // recent access frequency
-    bool MRU_bit; // mru bit to represent last access
-} block;
-
-typedef struct set_t
-{
-    block *blocks;
-} set;
+// Most levels a hierarchy can have: L1, L2 and up to
+// SIM_MAX_LEVELS - 2 outer levels (L3, ...)
+static const uint64_t SIM_MAX_LEVELS = 8;
 
+// Tag store of one cache, held in a single allocation in
+// structure-of-arrays form. Block (set i, way j) is entry i * num_ways + j
+// of the per-block arrays. The valid, dirty, prefetched and MRU flags are
+// bitmaps with flag_words 64-bit words per set.
+//
+// LRU order is a doubly-linked list of the ways of each set that have been
+// filled, threaded through lru_prev/lru_next (way numbers, WAY_NIL at the
+// ends), from lru_head (MRU) to lru_tail (LRU). Invalidating a way leaves it
+// linked where it was; empty ways are refilled before any victim is picked,
+// so the list is only read for victims when every way it holds is valid.
+//
+// LFU keeps the ways of each set that have been filled in a binary
+// min-heap ordered by (frequency, tag): lfu_heap holds lfu_size way numbers
+// per set and lfu_pos the heap position of each way. Invalidated ways stay
+// in the heap with their old frequency until refilled, which, as with LRU,
+// happens before any victim is picked. lfu_mru is the set's MRU way, or
+// WAY_NIL.
 typedef struct cache_t
 {
     cache_config_t config;
-    set *sets;
-    uint64_t timestamp_counter;
+    uint64_t num_sets;
+    uint64_t num_ways;
+    uint64_t flag_words;
+    uint64_t *tags;
+    uint64_t *frequencies; // recent access frequency (LFU)
+    uint64_t *valid_bits;
+    uint64_t *dirty_bits;
+    uint64_t *prefetched_bits; // prefetched and not read since (level walk)
+    uint32_t *lru_prev;
+    uint32_t *lru_next;
+    uint32_t *lru_head;
+    uint32_t *lru_tail;
+    uint32_t *lfu_heap;
+    uint32_t *lfu_pos;
+    uint32_t *lfu_size;
+    uint32_t *lfu_mru;
+    void *storage;
+    uint64_t timestamp_counter; // counts recency updates, for DEBUG output
+    tag_match_fn match_tags; // picked for this CPU and associativity
 } cache;
 
+// Fully associative victim cache between L1 and L2, held in a single
+// allocation like a cache_t. The used entries form an LRU list threaded
+// through prev/next from ends[0] (MRU) to ends[1] (LRU); unused ones a free
+// list from ends[2] through next. slots is an open-addressed (linear
+// probing) hash table of entry numbers keyed by block address, so lookups
+// don't scan the entries.
+typedef struct victim_cache
+{
+    uint64_t num_entries;
+    uint64_t b;
+    uint64_t slot_mask;
+    uint64_t *block_addrs;
+    uint32_t *prev;
+    uint32_t *next;
+    uint32_t *slots;
+    uint32_t *ends;
+    uint8_t *dirty;
+    void *storage;
+} victim_cache_t;
+
+// Most entries a victim cache can have
+static const uint64_t VICTIM_MAX_ENTRIES = 1 << 16;
+
+// Deepest write buffer; it is searched linearly
+static const uint64_t WRITE_BUFFER_MAX_DEPTH = 64;
+
 typedef struct sim_config
 {
     cache_config_t l1_config;
     cache_config_t l2_config;
+    // Instruction L1 beside l1_config (then the data L1). Disabled means a
+    // unified L1 that treats fetches as reads
+    cache_config_t l1i_config;
+    // Entries of the victim cache between L1 and L2, 0 = none
+    uint64_t victim_entries;
+    // Entries of the coalescing write buffer between the last level and
+    // DRAM, 0 = none
+    uint64_t write_buffer_depth;
+    // Report how accurate each level's prefetcher is, which the level walk
+    // keeps track of
+    bool prefetch_stats;
+    // Fraction of the set groups to simulate (1 = every set, exact).
+    // See Simulator::setup()
+    double sample_rate;
+    // Time sampling: every window_period accesses, fast-forward, then
+    // simulate window_warmup accesses unmeasured and window_length
+    // measured. 0 = off
+    uint64_t window_period;
+    uint64_t window_warmup;
+    uint64_t window_length;
+    // Levels below L2, nearest first. They need L2 and share its block
+    // size and replacement policy; set and time sampling don't apply
+    uint64_t num_outer_levels;
+    cache_config_t outer_configs[SIM_MAX_LEVELS - 2];
 } sim_config_t;
 
 typedef struct sim_stats
@@ -92,6 +196,22 @@ typedef struct sim_stats
     uint64_t misses_l1;
     uint64_t read_misses_l2;
     uint64_t prefetches_l2;
+    uint64_t accesses_l1i;
+    uint64_t hits_l1i;
+    uint64_t misses_l1i;
+    // Blocks dropped above an inclusive level when it evicted them
+    uint64_t back_invalidations;
+    // L1 misses that found / didn't find their block in the victim cache
+    uint64_t hits_vc;
+    uint64_t misses_vc;
+    // Block writes DRAM received, and those the write buffer merged into
+    // a write still waiting in it
+    uint64_t writes_dram;
+    uint64_t write_buffer_merges;
+    // L2 reads that hit a block a prefetch brought in, and L2 read misses
+    // to blocks a prefetch evicted (see sim_config_t::prefetch_stats)
+    uint64_t useful_prefetches_l2;
+    uint64_t polluting_misses_l2;
 
     double hit_ratio_l1;
     double read_hit_ratio_l2;
@@ -99,14 +219,83 @@ typedef struct sim_stats
     double read_miss_ratio_l2;
     double avg_access_time_l1;
     double avg_access_time_l2;
+    double hit_ratio_l1i;
+    double miss_ratio_l1i;
+    double avg_access_time_l1i;
+    double hit_ratio_vc;
+    // Useful prefetches per prefetch, and per read that missed or would
+    // have without them (0 if there were none)
+    double prefetch_accuracy_l2;
+    double prefetch_coverage_l2;
 } sim_stats_t;
 
-extern void sim_setup(sim_config_t *config);
-extern void sim_access(char rw, uint64_t addr, sim_stats_t *p_stats);
-extern void sim_finish(sim_stats_t *p_stats);
+// How a set-sampled run was estimated. The *_err fields are the half
+// widths of the 95% confidence intervals of the matching sim_stats_t
+// ratios; NAN where there were too few sampled groups to tell.
+typedef struct sim_sample_stats
+{
+    uint64_t groups;
+    uint64_t sampled_groups;
+    uint64_t accesses;
+    uint64_t sampled_accesses;
+
+    double miss_ratio_l1_err;
+    double read_miss_ratio_l2_err;
+    double avg_access_time_l1_err;
+} sim_sample_stats_t;
+
+// How a time-sampled run was measured: the number of complete windows and
+// the mean and variance across them of the per-window ratios
+typedef struct sim_window_stats
+{
+    uint64_t windows;
+    uint64_t accesses;
+    uint64_t measured_accesses;
+
+    double hit_ratio_l1_mean;
+    double hit_ratio_l1_var;
+    double read_hit_ratio_l2_mean;
+    double read_hit_ratio_l2_var;
+    double avg_access_time_l1_mean;
+    double avg_access_time_l1_var;
+} sim_window_stats_t;
+
+// Statistics of a level below L2, like the L2 ones of sim_stats_t
+typedef struct sim_level_stats
+{
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_hits;
+    uint64_t read_misses;
+    uint64_t prefetches;
+    uint64_t useful_prefetches;
+    uint64_t polluting_misses;
+
+    double read_hit_ratio;
+    double read_miss_ratio;
+    double avg_access_time;
+    double prefetch_accuracy;
+    double prefetch_coverage;
+} sim_level_stats_t;
+
+// Accesses whose tags and sets access_batch() computes ahead in one pass
+static const size_t ACCESS_BATCH_BLOCK = 64;
+
+// Marks the end of a per-set list or an unused way slot
+static const uint32_t WAY_NIL = UINT32_MAX;
+
+static const double DRAM_ACCESS_TIME = 100;
+static const double L1_HIT_K0 = 1;
+static const double L1_HIT_K1 = 0.15;
+static const double L1_HIT_K2 = 0.15;
+static const double L2_HIT_K3 = 4;
+static const double L2_HIT_K4 = 0.3;
+static const double L2_HIT_K5 = 0.3;
+static const double VICTIM_HIT_TIME = 1;
 
 // Sorry about the /* comments */. C++11 cannot handle basic C99 syntax,
 // unfortunately
+
 static const sim_config_t DEFAULT_SIM_CONFIG = {
     /*.l1_config =*/{/*.disabled =*/false,
                      /*.prefetcher_disabled =*/true,
@@ -116,7 +305,12 @@ static const sim_config_t DEFAULT_SIM_CONFIG = {
                      /*.s =*/1,  // 2-way
                      /*.replace_policy =*/REPLACE_POLICY_LRU,
                      /*.prefetch_insert_policy =*/INSERT_POLICY_MIP,
-                     /*.write_strat =*/WRITE_STRAT_WBWA},
+                     /*.write_strat =*/WRITE_STRAT_WBWA,
+                     /*.hit_time =*/{L1_HIT_K0, L1_HIT_K1, L1_HIT_K2},
+                     /*.inclusion =*/INCLUSION_NINE,
+                     /*.prefetch_kind =*/PREFETCH_NONE,
+                     /*.prefetch_degree =*/1,
+                     /*.prefetch_distance =*/1},
 
     /*.l2_config =*/{/*.disabled =*/false,
                      /*.prefetcher_disabled =*/false,
@@ -126,22 +320,60 @@ static const sim_config_t DEFAULT_SIM_CONFIG = {
                      /*.s =*/3,  // 8-way
                      /*.replace_policy =*/REPLACE_POLICY_LRU,
                      /*.prefetch_insert_policy =*/INSERT_POLICY_LIP,
-                     /*.write_strat =*/WRITE_STRAT_WTWNA}};
+                     /*.write_strat =*/WRITE_STRAT_WTWNA,
+                     /*.hit_time =*/{L2_HIT_K3, L2_HIT_K4, L2_HIT_K5},
+                     /*.inclusion =*/INCLUSION_NINE,
+                     /*.prefetch_kind =*/PREFETCH_NONE,
+                     /*.prefetch_degree =*/1,
+                     /*.prefetch_distance =*/1},
+
+    /*.l1i_config =*/{/*.disabled =*/true,
+                      /*.prefetcher_disabled =*/true,
+                      /*.strided_prefetch_disabled =*/true,
+                      /*.c =*/10, // 1KB Cache
+                      /*.b =*/6,  // 64-byte blocks
+                      /*.s =*/1,  // 2-way
+                      /*.replace_policy =*/REPLACE_POLICY_LRU,
+                      /*.prefetch_insert_policy =*/INSERT_POLICY_MIP,
+                      /*.write_strat =*/WRITE_STRAT_WBWA,
+                      /*.hit_time =*/{L1_HIT_K0, L1_HIT_K1, L1_HIT_K2},
+                      /*.inclusion =*/INCLUSION_NINE,
+                      /*.prefetch_kind =*/PREFETCH_NONE,
+                      /*.prefetch_degree =*/1,
+                      /*.prefetch_distance =*/1},
+
+    /*.victim_entries =*/0,
+    /*.write_buffer_depth =*/0,
+    /*.prefetch_stats =*/false,
+    /*.sample_rate =*/1.0,
+    /*.window_period =*/0,
+    /*.window_warmup =*/0,
+    /*.window_length =*/0,
+    /*.num_outer_levels =*/0};
 
 // Argument to cache_access rw. Indicates a load
 static const char READ = 'R';
 // Argument to cache_access rw. Indicates a store
 static const char WRITE = 'W';
-
-static const double DRAM_ACCESS_TIME = 100;
-static const double L1_HIT_K0 = 1;
-static const double L1_HIT_K1 = 0.15;
-static const double L1_HIT_K2 = 0.15;
-static const double L2_HIT_K3 = 4;
-static const double L2_HIT_K4 = 0.3;
-static const double L2_HIT_K5 = 0.3;
+// Argument to cache_access rw. Indicates an instruction fetch
+static const char FETCH = 'I';
 
 // int timer = 0;
+void initCache(cache *cache, const cache_config_t *config);
+void attachCache(cache *cache, const cache_config_t *config, void *storage);
+void copyCache(cache *cache, const cache_t *from, const cache_config_t *config);
+size_t cacheStorageBytes(const cache *cache);
+double cacheHitTime(const cache_config_t *config);
+prefetch_kind_t prefetchKindOf(const cache_config_t *config);
+void freeCache(cache *cache);
+void initVictimCache(victim_cache_t *victims, uint64_t num_entries, uint64_t b);
+void attachVictimCache(victim_cache_t *victims, uint64_t num_entries, uint64_t b, void *storage);
+void copyVictimCache(victim_cache_t *victims, const victim_cache_t *from);
+size_t victimStorageBytes(uint64_t num_entries);
+void freeVictimCache(victim_cache_t *victims);
+bool victimHolds(const victim_cache_t *victims, uint64_t block_addr);
+bool victimTake(victim_cache_t *victims, uint64_t block_addr, bool *dirty);
+bool victimPut(victim_cache_t *victims, uint64_t block_addr, bool dirty, uint64_t *evicted_addr, bool *evicted_dirty);
 uint64_t getIndex(uint64_t addr, cache *cache);
 uint64_t getTag(uint64_t addr, cache *cache);
 bool getValidBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
@@ -150,21 +382,212 @@ void clearValidBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
 bool getDirtyBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
 void setDirtyBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
 void clearDirtyBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
-void updateTimestampOnAccess(cache_t *cache, uint64_t set_index, uint64_t block_index);
-void updateTimestampOnMiss(cache_t *cache, uint64_t set_index, uint64_t block_index);
-void updateTimestamp(cache_t *cache, uint64_t set_index, uint64_t block_index);
+bool getPrefetchedBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
+void setPrefetchedBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
+void clearPrefetchedBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
+void clearMRUBit(cache_t *cache, uint64_t set_index, uint64_t block_index);
+uint64_t getBlockTag(cache_t *cache, uint64_t set_index, uint64_t block_index);
+void setFrequency(cache_t *cache, uint64_t set_index, uint64_t block_index, uint64_t frequency);
+void incrementFrequency(cache_t *cache, uint64_t set_index, uint64_t block_index);
+void moveToMRU(cache_t *cache, uint64_t set_index, uint64_t block_index);
+void insertAtLRU(cache_t *cache, uint64_t set_index, uint64_t block_index);
 void setTag(cache *cache, uint64_t set_index, uint64_t block_index, uint64_t tag);
-uint64_t findLRUBlockIndex(set *cache_set, uint64_t set_size);
-uint64_t findMRUBlockIndex(set *cache_set, uint64_t set_size);
-uint64_t findTargetBlockIndex(set *cache_set, uint64_t set_size, uint64_t tag);
+uint64_t findLRUBlockIndex(cache *cache, uint64_t set_index, uint64_t set_size);
 uint64_t findEmptyBlockIndex(cache *cache, uint64_t set_index, uint64_t set_size);
-uint64_t prefetchInCache(cache *cache, uint64_t new_block_addr);
-bool checkAllEmpty(cache *cache, uint64_t set_index);
-void prefetch(cache_t *cache, uint64_t addr, sim_stats_t* stats);
+uint64_t findValidBlockIndex(cache *cache, uint64_t set_index, uint64_t tag);
 uint64_t blockAddrTrans(cache* cache, uint64_t addr);
 void setMRUBitNewAndClearOther(cache *cache, uint64_t set_index, uint64_t block_index);
-uint64_t findLFUBlockIndex(set *cache_set, uint64_t set_size);
+uint64_t findLFUBlockIndex(cache *cache, uint64_t set_index, uint64_t set_size);
+
+// One simulated L1/L2 hierarchy. Each instance owns its caches, prefetcher
+// state and statistics, so independent instances can run side by side
+// (e.g. one per thread).
+class Simulator
+{
+public:
+    Simulator();
+    ~Simulator();
+
+    void setup(const sim_config_t *config);
+    void access(char rw, uint64_t addr);
+    void access_batch(const uint64_t *addrs, const uint8_t *rws, size_t n);
+    void finish();
+    // Save the whole run state (after trace_offset records) to a file, or
+    // resume from one in place of setup(). 0 on success.
+    int save_checkpoint(const char *path, uint64_t trace_offset) const;
+    int load_checkpoint(const char *path, uint64_t *trace_offset);
+    // Make this simulator an independent copy of other's current state.
+    // config may switch the L2 prefetcher and insertion policy; everything
+    // else must match other's. 0 on success.
+    int clone_from(const Simulator &other, const sim_config_t *config);
+    // Zero the statistics, e.g. to measure only what follows a clone
+    void reset_stats();
+    const sim_config_t *get_config() const { return &config; }
+    const sim_stats_t *get_stats() const { return &stats; }
+    // Statistics of level 3 (L3) and below; NULL past the last level
+    const sim_level_stats_t *get_level_stats(uint64_t level) const;
+    // NULL unless the run was set-sampled
+    const sim_sample_stats_t *get_sample_stats() const { return sampling ? &sample_stats : NULL; }
+    // NULL unless the run was time-sampled
+    const sim_window_stats_t *get_window_stats() const { return windowing ? &window_stats : NULL; }
+
+private:
+    Simulator(const Simulator &) = delete;
+    Simulator &operator=(const Simulator &) = delete;
+
+    // The access path is one routine templated on the replacement policy
+    // traits, the L2 insertion policy, prefetcher and presence, and the
+    // geometry of each cache; setup() points access_impl and batch_impl at
+    // the instance matching the configuration
+    typedef void (Simulator::*access_fn)(char rw, uint64_t addr);
+    typedef void (Simulator::*batch_fn)(const uint64_t *addrs, const uint8_t *rws, size_t n);
+    template <class Policy>
+    void selectAccess();
+    template <class Policy, class L1Geometry, class L2Geometry>
+    void selectL2Access();
+    template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, bool HasL2, class L1Geometry, class L2Geometry>
+    void useKernel();
+    template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, bool HasL2, class L1Geometry, class L2Geometry>
+    void accessWith(char rw, uint64_t addr);
+    template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, bool HasL2, class L1Geometry, class L2Geometry>
+    void accessBatchWith(const uint64_t *addrs, const uint8_t *rws, size_t n);
+    template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, bool HasL2, class L1Geometry, class L2Geometry>
+    void accessStep(char rw, uint64_t addr, uint64_t tag, uint64_t index, sim_stats_t &st);
+    template <class Policy, insert_policy_t Insert, prefetch_kind_t Prefetch, class Geometry>
+    void prefetchWith(uint64_t addr, sim_stats_t &st);
+    template <class Geometry>
+    uint64_t isInCache(char rw, uint64_t tag, uint64_t index, cache *cache, sim_stats_t &st);
+
+    // Generic path for hierarchies the kernels above don't cover: levels
+    // below L2, a split L1, a victim cache, a write buffer, inclusive or
+    // exclusive levels, or write strategies other than a WBWA L1 over a
+    // WTWNA L2.
+    // It walks the levels (0 = L1) one call per level.
+    bool walksLevels() const;
+    cache *levelCache(uint64_t level) const;
+    template <class Policy>
+    void accessLevelsWith(char rw, uint64_t addr);
+    template <class Policy>
+    void accessLevelsBatchWith(const uint64_t *addrs, const uint8_t *rws, size_t n);
+    template <class Policy>
+    void warmLevelsWith(const uint64_t *addrs, const uint8_t *rws, size_t n);
+    template <class Policy>
+    void fetchLevelsWith(uint64_t addr);
+    template <class Policy>
+    bool readLevel(uint64_t level, uint64_t addr, bool *dirty);
+    template <class Policy>
+    void writeLevel(uint64_t level, uint64_t addr);
+    template <class Policy>
+    void fillLevel(cache *c, uint64_t level, uint64_t addr, bool fetch, bool dirty);
+    template <class Policy>
+    void prefetchLevel(uint64_t level, uint64_t addr);
+    template <class Policy>
+    void prefetchBlock(uint64_t level, uint64_t addr, uint64_t new_block_addr);
+    template <class Policy>
+    void evictLevel(uint64_t level, uint64_t victim_addr, bool dirty);
+    template <class Policy>
+    void insertVictim(uint64_t level, uint64_t addr, bool dirty);
+    template <class Policy>
+    void includeIn(uint64_t level, uint64_t addr);
+    void takeFromBelow(uint64_t level, uint64_t addr, bool *dirty);
+    bool invalidateIn(cache *c, uint64_t addr, bool *dirty);
+    bool backInvalidate(uint64_t level, uint64_t addr);
+    bool heldAbove(uint64_t level, uint64_t addr) const;
+    void writeMemory(uint64_t addr);
+    void drainWriteBuffer();
+    bool takeVictim(uint64_t addr, bool *dirty);
+    template <class Policy>
+    void putVictim(uint64_t addr, bool dirty);
+    void countRead(uint64_t level, bool hit);
+    void countWrite(uint64_t level);
+    void countPrefetch(uint64_t level);
+    void countUsefulPrefetch(uint64_t level);
+    void countPollutingMiss(uint64_t level);
+
+    // Per set group counters of a set-sampled run
+    struct sample_group
+    {
+        uint64_t accesses_l1;
+        uint64_t misses_l1;
+        uint64_t reads_l2;
+        uint64_t read_misses_l2;
+    };
+    void sampledAccess(char rw, uint64_t addr);
+    void finishSampling();
+    double sampleRatioError(uint64_t sample_group::*num, uint64_t sample_group::*den) const;
+
+    // Running mean and variance of one per-window ratio
+    struct window_metric
+    {
+        uint64_t n;
+        double mean;
+        double m2;
+    };
+    void windowedBatch(const uint64_t *addrs, const uint8_t *rws, size_t n);
+    void closeWindow();
+    void finishWindows();
+    template <class Policy, bool HasL2, class L1Geometry, class L2Geometry>
+    void warmWith(const uint64_t *addrs, const uint8_t *rws, size_t n);
+
+    void computeRatios(sim_stats_t *st) const;
+    void computeLevelRatios();
+
+    void configure(const sim_config_t *config);
+    void freeCaches();
+
+    // Layout of a checkpoint file, see cachesim_checkpoint.cpp
+    struct checkpoint_header;
+    bool writeOuterSections(FILE *f, const checkpoint_header *header) const;
+    void releaseCheckpoint();
+
+    sim_config_t config;
+    access_fn access_impl;
+    batch_fn batch_impl;
+    cache *L1;
+    cache *L2;
+    // Instruction L1 of a split L1, else NULL
+    cache *L1I;
+    // num_entries is 0 without a victim cache
+    victim_cache_t victims;
+    // Block addresses waiting to be written to DRAM, oldest at
+    // write_buffer_head, in a ring of config.write_buffer_depth
+    uint64_t write_buffer[WRITE_BUFFER_MAX_DEPTH];
+    uint64_t write_buffer_head;
+    uint64_t write_buffer_count;
+    // Prefetcher state of L2 and the levels below, from L2 on
+    prefetcher_t prefetchers[SIM_MAX_LEVELS - 1];
+    sim_stats_t stats;
+
+    // Levels in use (1 with L2 disabled) and those below L2
+    uint64_t num_levels;
+    cache *outer[SIM_MAX_LEVELS - 2];
+    sim_level_stats_t outer_stats[SIM_MAX_LEVELS - 2];
+
+    bool sampling;
+    uint64_t sample_bits;
+    uint64_t sample_threshold;
+    uint64_t seen_reads;
+    uint64_t seen_writes;
+    sample_group *sample_groups;
+    sim_sample_stats_t sample_stats;
+
+    bool windowing;
+    batch_fn warm_impl;
+    uint64_t window_period;
+    uint64_t window_warmup;
+    uint64_t window_length;
+    uint64_t window_pos;
+    sim_stats_t window_start;
+    sim_stats_t measured;
+    window_metric window_hit_ratio_l1;
+    window_metric window_read_hit_ratio_l2;
+    window_metric window_avg_access_time_l1;
+    sim_window_stats_t window_stats;
 
-uint64_t isInCache(char rw, uint64_t addr, sim_stats_t *stats, cache *cache);
+    // The mapped checkpoint that L1, L2 and sample_groups live in after
+    // load_checkpoint(), if any
+    void *checkpoint_map;
+    size_t checkpoint_bytes;
+};
 
 #endif /* CACHESIM_HPP */
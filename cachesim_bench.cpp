@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <vector>
+#include "cachesim_simd.hpp"
+
+// cachesim-bench: time the tag-match kernels against each other on random
+// lookups (half hits, half misses) for every associativity from 1 to 64.
+
+#define BENCH_SETS 1024
+#define BENCH_LOOKUPS (1 << 22)
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Lookup results end up here, so the compiler can't drop the work
+static volatile uint64_t sink;
+
+// Returns ns per lookup
+static double time_kernel(tag_match_fn match, const std::vector<uint64_t> &tags, uint64_t ways,
+                          const std::vector<uint32_t> &sets, const std::vector<uint64_t> &keys) {
+    double start = now_ns();
+    uint64_t acc = 0;
+    for (size_t i = 0; i < sets.size(); i++) {
+        acc += match(&tags[sets[i] * ways], ways, keys[i]);
+    }
+    double elapsed = now_ns() - start;
+    sink = sink + acc;
+    return elapsed / sets.size();
+}
+
+int main(void) {
+    struct {
+        const char *name;
+        tag_match_fn fn;
+        bool usable;
+    } kernels[] = {
+        {"scalar", matchTagsScalar, true},
+        {"sse4", matchTagsSSE4, cpuHasSSE4()},
+        {"avx2", matchTagsAVX2, cpuHasAVX2()},
+    };
+    const size_t num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    srand(1);
+    printf("%4s", "ways");
+    for (size_t k = 0; k < num_kernels; k++) {
+        printf(" %10s", kernels[k].name);
+    }
+    printf(" %10s %8s\n", "selected", "speedup");
+
+    for (uint64_t ways = 1; ways <= 64; ways *= 2) {
+        std::vector<uint64_t> tags(BENCH_SETS * ways);
+        for (size_t i = 0; i < tags.size(); i++) {
+            tags[i] = ((uint64_t)rand() << 20) ^ rand();
+        }
+        std::vector<uint32_t> sets(BENCH_LOOKUPS);
+        std::vector<uint64_t> keys(BENCH_LOOKUPS);
+        for (size_t i = 0; i < sets.size(); i++) {
+            sets[i] = rand() % BENCH_SETS;
+            keys[i] = (rand() & 1) ? tags[sets[i] * ways + rand() % ways] : ~(uint64_t)0;
+        }
+
+        double scalar_ns = 0;
+        printf("%4" PRIu64, ways);
+        for (size_t k = 0; k < num_kernels; k++) {
+            if (!kernels[k].usable) {
+                printf(" %10s", "-");
+                continue;
+            }
+            double ns = time_kernel(kernels[k].fn, tags, ways, sets, keys);
+            if (k == 0) {
+                scalar_ns = ns;
+            }
+            printf(" %7.2f ns", ns);
+        }
+        tag_match_fn chosen = selectTagMatch(ways);
+        double chosen_ns = time_kernel(chosen, tags, ways, sets, keys);
+        const char *chosen_name = "?";
+        for (size_t k = 0; k < num_kernels; k++) {
+            if (kernels[k].fn == chosen) {
+                chosen_name = kernels[k].name;
+            }
+        }
+        printf(" %10s %7.2fx\n", chosen_name, scalar_ns / chosen_ns);
+    }
+
+    return 0;
+}
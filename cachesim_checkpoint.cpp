@@ -0,0 +1,352 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include "cachesim.hpp"
+
+// A checkpoint is this header followed by the L1, L2, outer level and L1I
+// tag stores, the victim cache and, for a set-sampled run, the sample
+// groups, each starting on a page boundary.
+// The sections are the in-memory arrays as they are, so load_checkpoint()
+// maps the file copy-on-write and points the caches into it without reading
+// or parsing anything. The file is only meant to be read back by the same
+// build on the same machine type; header_bytes catches layout changes.
+struct Simulator::checkpoint_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint64_t trace_offset;
+
+    sim_config_t config;
+    prefetcher_t prefetchers[SIM_MAX_LEVELS - 1];
+    uint64_t timestamp_counter_l1;
+    uint64_t timestamp_counter_l2;
+    uint64_t timestamp_counter_l1i;
+    sim_stats_t stats;
+    uint64_t timestamp_counter_outer[SIM_MAX_LEVELS - 2];
+    sim_level_stats_t outer_stats[SIM_MAX_LEVELS - 2];
+    uint64_t write_buffer[WRITE_BUFFER_MAX_DEPTH];
+    uint64_t write_buffer_head;
+    uint64_t write_buffer_count;
+
+    uint64_t seen_reads;
+    uint64_t seen_writes;
+
+    uint64_t window_pos;
+    sim_stats_t window_start;
+    sim_stats_t measured;
+    window_metric window_hit_ratio_l1;
+    window_metric window_read_hit_ratio_l2;
+    window_metric window_avg_access_time_l1;
+    sim_window_stats_t window_stats;
+
+    uint64_t l1_offset;
+    uint64_t l1_bytes;
+    uint64_t l2_offset;
+    uint64_t l2_bytes;
+    uint64_t outer_offset[SIM_MAX_LEVELS - 2];
+    uint64_t outer_bytes[SIM_MAX_LEVELS - 2];
+    uint64_t l1i_offset;
+    uint64_t l1i_bytes;
+    uint64_t victims_offset;
+    uint64_t victims_bytes;
+    uint64_t groups_offset;
+    uint64_t groups_bytes;
+};
+
+static const char CHECKPOINT_MAGIC[8] = {'C', 'S', 'C', 'K', 'P', 'T', '\0', '\0'};
+static const uint32_t CHECKPOINT_VERSION = 8;
+
+// Enough of a check that a damaged header can't size the caches absurdly
+static bool checkpointCacheValid(const cache_config_t *config)
+{
+    return config->c < 48 && config->b + config->s <= config->c;
+}
+
+static uint64_t pageAlign(uint64_t offset)
+{
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    return (offset + page - 1) & ~(page - 1);
+}
+
+// Write bytes at offset, zero filling any gap before it
+static bool writeSection(FILE *f, uint64_t offset, const void *data, size_t bytes)
+{
+    static const char zeros[4096] = {0};
+    long pos = ftell(f);
+    while (pos >= 0 && (uint64_t)pos < offset)
+    {
+        size_t n = std::min((uint64_t)sizeof zeros, offset - pos);
+        if (fwrite(zeros, 1, n, f) != n)
+        {
+            return false;
+        }
+        pos += n;
+    }
+    return pos >= 0 && fwrite(data, 1, bytes, f) == bytes;
+}
+
+bool Simulator::writeOuterSections(FILE *f, const checkpoint_header *header) const
+{
+    for (uint64_t level = 2; level < num_levels; level++)
+    {
+        if (!writeSection(f, header->outer_offset[level - 2], outer[level - 2]->tags, header->outer_bytes[level - 2]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The file is written next to path and renamed over it, so a crash midway
+// leaves the previous checkpoint intact
+int Simulator::save_checkpoint(const char *path, uint64_t trace_offset) const
+{
+    if (L1 == NULL)
+    {
+        printf("ERROR: no simulation to checkpoint\n");
+        return 1;
+    }
+
+    checkpoint_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof header.magic);
+    header.version = CHECKPOINT_VERSION;
+    header.header_bytes = sizeof header;
+    header.trace_offset = trace_offset;
+    header.config = config;
+    memcpy(header.prefetchers, prefetchers, sizeof header.prefetchers);
+    header.timestamp_counter_l1 = L1->timestamp_counter;
+    header.timestamp_counter_l2 = L2->timestamp_counter;
+    header.stats = stats;
+    memcpy(header.write_buffer, write_buffer, sizeof header.write_buffer);
+    header.write_buffer_head = write_buffer_head;
+    header.write_buffer_count = write_buffer_count;
+    memcpy(header.outer_stats, outer_stats, sizeof header.outer_stats);
+    header.seen_reads = seen_reads;
+    header.seen_writes = seen_writes;
+    header.window_pos = window_pos;
+    header.window_start = window_start;
+    header.measured = measured;
+    header.window_hit_ratio_l1 = window_hit_ratio_l1;
+    header.window_read_hit_ratio_l2 = window_read_hit_ratio_l2;
+    header.window_avg_access_time_l1 = window_avg_access_time_l1;
+    header.window_stats = window_stats;
+
+    header.l1_offset = pageAlign(sizeof header);
+    header.l1_bytes = cacheStorageBytes(L1);
+    header.l2_offset = pageAlign(header.l1_offset + header.l1_bytes);
+    header.l2_bytes = cacheStorageBytes(L2);
+    uint64_t end = header.l2_offset + header.l2_bytes;
+    for (uint64_t level = 2; level < num_levels; level++)
+    {
+        header.timestamp_counter_outer[level - 2] = outer[level - 2]->timestamp_counter;
+        header.outer_offset[level - 2] = pageAlign(end);
+        header.outer_bytes[level - 2] = cacheStorageBytes(outer[level - 2]);
+        end = header.outer_offset[level - 2] + header.outer_bytes[level - 2];
+    }
+    if (L1I != NULL)
+    {
+        header.timestamp_counter_l1i = L1I->timestamp_counter;
+        header.l1i_offset = pageAlign(end);
+        header.l1i_bytes = cacheStorageBytes(L1I);
+        end = header.l1i_offset + header.l1i_bytes;
+    }
+    if (victims.num_entries)
+    {
+        header.victims_offset = pageAlign(end);
+        header.victims_bytes = victimStorageBytes(victims.num_entries);
+        end = header.victims_offset + header.victims_bytes;
+    }
+    if (sampling)
+    {
+        header.groups_offset = pageAlign(end);
+        header.groups_bytes = (1UL << sample_bits) * sizeof(sample_group);
+    }
+
+    std::string tmp_path = std::string(path) + ".tmp";
+    FILE *f = fopen(tmp_path.c_str(), "wb");
+    if (!f)
+    {
+        printf("ERROR: can't create checkpoint %s\n", tmp_path.c_str());
+        return 1;
+    }
+    bool ok = writeSection(f, 0, &header, sizeof header) &&
+              writeSection(f, header.l1_offset, L1->tags, header.l1_bytes) &&
+              writeSection(f, header.l2_offset, L2->tags, header.l2_bytes) &&
+              writeOuterSections(f, &header) &&
+              (L1I == NULL || writeSection(f, header.l1i_offset, L1I->tags, header.l1i_bytes)) &&
+              (!victims.num_entries ||
+               writeSection(f, header.victims_offset, victims.block_addrs, header.victims_bytes)) &&
+              (!sampling || writeSection(f, header.groups_offset, sample_groups, header.groups_bytes));
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path.c_str(), path))
+    {
+        printf("ERROR: can't write checkpoint %s\n", path);
+        unlink(tmp_path.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+// Replaces setup(): the configuration and the whole run state come from
+// the checkpoint. The file stays mapped until the caches are freed.
+int Simulator::load_checkpoint(const char *path, uint64_t *trace_offset)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("ERROR: can't open checkpoint %s\n", path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(checkpoint_header))
+    {
+        printf("ERROR: %s: not a checkpoint\n", path);
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("ERROR: can't map checkpoint %s\n", path);
+        return 1;
+    }
+
+    const checkpoint_header *header = (const checkpoint_header *)map;
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof header->magic) ||
+        header->version != CHECKPOINT_VERSION || header->header_bytes != sizeof(checkpoint_header) ||
+        !checkpointCacheValid(&header->config.l1_config) || !checkpointCacheValid(&header->config.l2_config) ||
+        header->config.num_outer_levels > SIM_MAX_LEVELS - 2 ||
+        header->config.write_buffer_depth > WRITE_BUFFER_MAX_DEPTH ||
+        header->write_buffer_count > header->config.write_buffer_depth ||
+        header->write_buffer_head >= std::max(header->config.write_buffer_depth, (uint64_t)1))
+    {
+        printf("ERROR: %s: corrupt or unsupported checkpoint\n", path);
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    cache l1_shape;
+    cache l2_shape;
+    attachCache(&l1_shape, &header->config.l1_config, NULL);
+    attachCache(&l2_shape, &header->config.l2_config, NULL);
+    uint64_t end = std::max(header->l1_offset + header->l1_bytes,
+                            std::max(header->l2_offset + header->l2_bytes,
+                                     header->groups_offset + header->groups_bytes));
+    bool valid = header->l1_bytes == cacheStorageBytes(&l1_shape) && header->l2_bytes == cacheStorageBytes(&l2_shape);
+    uint64_t levels = header->config.l2_config.disabled ? 1 : 2 + header->config.num_outer_levels;
+    for (uint64_t level = 2; valid && level < levels; level++)
+    {
+        const cache_config_t *outer_config = &header->config.outer_configs[level - 2];
+        cache shape;
+        valid = checkpointCacheValid(outer_config);
+        if (valid)
+        {
+            attachCache(&shape, outer_config, NULL);
+            valid = header->outer_bytes[level - 2] == cacheStorageBytes(&shape) &&
+                    header->outer_offset[level - 2] % 64 == 0;
+            end = std::max(end, header->outer_offset[level - 2] + header->outer_bytes[level - 2]);
+        }
+    }
+    if (valid && !header->config.l1i_config.disabled)
+    {
+        cache l1i_shape;
+        valid = checkpointCacheValid(&header->config.l1i_config);
+        if (valid)
+        {
+            attachCache(&l1i_shape, &header->config.l1i_config, NULL);
+            valid = header->l1i_bytes == cacheStorageBytes(&l1i_shape) && header->l1i_offset % 64 == 0;
+            end = std::max(end, header->l1i_offset + header->l1i_bytes);
+        }
+    }
+    if (valid && header->config.victim_entries)
+    {
+        valid = header->config.victim_entries <= VICTIM_MAX_ENTRIES &&
+                header->victims_bytes == victimStorageBytes(header->config.victim_entries) &&
+                header->victims_offset % 64 == 0;
+        end = std::max(end, header->victims_offset + header->victims_bytes);
+    }
+    if (!valid || (header->l1_offset | header->l2_offset | header->groups_offset) % 64 || end > (uint64_t)st.st_size)
+    {
+        printf("ERROR: %s: corrupt or unsupported checkpoint\n", path);
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    freeCaches();
+    L1 = (cache *)malloc(sizeof(cache));
+    L2 = (cache *)malloc(sizeof(cache));
+    attachCache(L1, &header->config.l1_config, (char *)map + header->l1_offset);
+    attachCache(L2, &header->config.l2_config, (char *)map + header->l2_offset);
+    for (uint64_t level = 2; level < levels; level++)
+    {
+        outer[level - 2] = (cache *)malloc(sizeof(cache));
+        attachCache(outer[level - 2], &header->config.outer_configs[level - 2],
+                    (char *)map + header->outer_offset[level - 2]);
+    }
+    if (!header->config.l1i_config.disabled)
+    {
+        L1I = (cache *)malloc(sizeof(cache));
+        attachCache(L1I, &header->config.l1i_config, (char *)map + header->l1i_offset);
+    }
+    if (header->config.victim_entries)
+    {
+        attachVictimCache(&victims, header->config.victim_entries, header->config.l1_config.b,
+                          (char *)map + header->victims_offset);
+    }
+    configure(&header->config);
+    checkpoint_map = map;
+    checkpoint_bytes = st.st_size;
+    if (sampling)
+    {
+        if (header->groups_bytes != (1UL << sample_bits) * sizeof(sample_group))
+        {
+            printf("ERROR: %s: corrupt or unsupported checkpoint\n", path);
+            freeCaches();
+            return 1;
+        }
+        sample_groups = (sample_group *)((char *)map + header->groups_offset);
+    }
+
+    memcpy(prefetchers, header->prefetchers, sizeof prefetchers);
+    L1->timestamp_counter = header->timestamp_counter_l1;
+    L2->timestamp_counter = header->timestamp_counter_l2;
+    if (L1I != NULL)
+    {
+        L1I->timestamp_counter = header->timestamp_counter_l1i;
+    }
+    for (uint64_t level = 2; level < num_levels; level++)
+    {
+        outer[level - 2]->timestamp_counter = header->timestamp_counter_outer[level - 2];
+    }
+    memcpy(write_buffer, header->write_buffer, sizeof write_buffer);
+    write_buffer_head = header->write_buffer_head;
+    write_buffer_count = header->write_buffer_count;
+    memcpy(outer_stats, header->outer_stats, sizeof outer_stats);
+    stats = header->stats;
+    seen_reads = header->seen_reads;
+    seen_writes = header->seen_writes;
+    window_pos = header->window_pos;
+    window_start = header->window_start;
+    measured = header->measured;
+    window_hit_ratio_l1 = header->window_hit_ratio_l1;
+    window_read_hit_ratio_l2 = header->window_read_hit_ratio_l2;
+    window_avg_access_time_l1 = header->window_avg_access_time_l1;
+    window_stats = header->window_stats;
+    *trace_offset = header->trace_offset;
+    return 0;
+}
+
+void Simulator::releaseCheckpoint()
+{
+    if (checkpoint_map != NULL)
+    {
+        munmap(checkpoint_map, checkpoint_bytes);
+        checkpoint_map = NULL;
+        checkpoint_bytes = 0;
+    }
+}
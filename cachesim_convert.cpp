@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include "cachesim_trace.hpp"
+
+// cachesim-convert: turn a text trace ("R 0x0000560feb6d7f70" per line)
+// into the packed binary format that cachesim maps directly.
+
+static void print_help(void) {
+    printf("cachesim-convert <input.trace> <output.bin>\n");
+    printf("Convert a text trace into a binary trace (8 bytes per access)\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3 || !strcmp(argv[1], "-h")) {
+        print_help();
+        return argc == 3 ? 0 : 1;
+    }
+
+    trace_reader_t reader;
+    if (trace_open(argv[1], &reader)) {
+        return 1;
+    }
+
+    FILE *out = fopen(argv[2], "wb");
+    if (!out) {
+        printf("ERROR: can't create file %s\n", argv[2]);
+        trace_close(&reader);
+        return 1;
+    }
+
+    /* The record count is only known at the end, so the header is written twice */
+    uint64_t num_records = 0;
+    const uint64_t *addrs;
+    const uint8_t *rws;
+    std::vector<uint64_t> records(TRACE_CHUNK);
+    size_t count;
+    bool unpackable = false;
+    int ret = trace_write_header(out, 0);
+    while (!ret && !unpackable && (count = trace_next(&reader, &addrs, &rws, TRACE_CHUNK))) {
+        for (size_t i = 0; i < count; i++) {
+            if (addrs[i] & TRACE_TYPE_BITS) {
+                printf("ERROR: %s: address 0x%016" PRIx64 " of record %" PRIu64 " uses the top two bits, "
+                       "which the binary format needs for the record type\n",
+                       argv[1], addrs[i], num_records + i + 1);
+                unpackable = true;
+                break;
+            }
+            records[i] = trace_pack(rws[i], addrs[i]);
+        }
+        if (!unpackable && fwrite(records.data(), sizeof(uint64_t), count, out) != count) {
+            ret = 1;
+        }
+        num_records += count;
+    }
+    if (!ret && !reader.failed && !unpackable) {
+        ret = fseek(out, 0, SEEK_SET) || trace_write_header(out, num_records);
+    }
+    if (fclose(out)) {
+        ret = 1;
+    }
+    if (ret) {
+        printf("ERROR: can't write file %s\n", argv[2]);
+    }
+    trace_close(&reader);
+    if (ret || reader.failed || unpackable) {
+        remove(argv[2]);
+        return 1;
+    }
+
+    printf("Converted %" PRIu64 " accesses from %s to %s\n", num_records, argv[1], argv[2]);
+    return 0;
+}
@@ -3,77 +3,205 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
 #include "cachesim.hpp"
+#include "cachesim_pool.hpp"
+#include "cachesim_stackdist.hpp"
+#include "cachesim_trace.hpp"
+
+// Short options shared by the command line and the lines of a sweep file
+static const char *OPTSTRING = "c:b:s:f:r:C:S:I:P:G:A:X:V:w:W:M:Dh";
+// Long-only options get values outside the char range
+enum { OPT_SWEEP = 256, OPT_JOBS, OPT_STACK_DISTANCE, OPT_SAMPLE_SETS,
+       OPT_PERIOD, OPT_WARMUP, OPT_WINDOW, OPT_CHECKPOINT, OPT_CHECKPOINT_EVERY, OPT_RESTORE,
+       OPT_FORK_AT, OPT_WHAT_IF, OPT_LEVEL, OPT_HIERARCHY, OPT_L1I, OPT_PREFETCH_STATS };
+// Largest cache size reported by --stack-distance unless given
+static const uint64_t STACK_DISTANCE_MAX_C = 20;
+
+// A whole trace held in memory, shared read-only by the parallel sweep jobs
+typedef struct trace_buffer
+{
+    std::string name;
+    std::vector<uint64_t> addrs;
+    std::vector<uint8_t> rws;
+} trace_buffer_t;
 
 static void print_help(void);
+static int apply_option(int opt, const char *arg, sim_config_t *config);
 static int parse_insert_policy(const char *arg, insert_policy_t *policy_out);
+static int parse_prefetcher(const char *arg, cache_config_t *level);
 static int parse_replace_policy(const char *arg, replace_policy_t *policy_out);
-static int validate_config(sim_config_t *config);
-static void print_cache_config(cache_config_t *cache_config, const char *cache_name);
-static void print_statistics(sim_stats_t* stats);
+static int parse_inclusion_policy(const char *arg, inclusion_policy_t *policy_out);
+static int parse_write_strat(const char *arg, write_strat_t *strat_out);
+static int parse_level(const char *spec, cache_config_t *level);
+static int add_level(const char *spec, sim_config_t *config);
+static int load_hierarchy(const char *hierarchy_fn, sim_config_t *config);
+static int validate_config(sim_config_t *config, bool verbose);
+static int load_sweep(const char *sweep_fn, const sim_config_t *base, std::vector<sim_config_t> *configs);
+static int replay_checkpointed(Simulator *sim, const uint64_t *addrs, const uint8_t *rws, size_t count, uint64_t *done,
+                               const char *checkpoint_fn, uint64_t checkpoint_every);
+static int run_sweep(std::vector<sim_config_t> *configs, trace_reader_t *reader);
+static int run_stack_distance(const cache_config_t *l1_config, trace_reader_t *reader, uint64_t max_c);
+static int load_trace(const char *trace_fn, trace_buffer_t *trace);
+static int run_parallel_sweep(std::vector<sim_config_t> *configs, const std::vector<std::string> &trace_fns, unsigned jobs);
+static int run_what_if(const Simulator *base, trace_reader_t *reader, uint64_t num_records, unsigned jobs);
+static void print_sweep_table(const std::vector<sim_config_t> &configs, const std::vector<trace_buffer_t> &traces,
+                              const std::vector<sim_stats_t> &results);
+static std::string config_label(const sim_config_t *config);
+static void print_cache_config(cache_config_t *cache_config, const char *cache_name, write_strat_t usual_write_strat);
+static void print_hierarchy_config(sim_config_t *config);
+static void print_run(sim_config_t *config, const Simulator *sim);
+static void print_statistics(const sim_stats_t* stats, bool split_l1);
+static void print_level_statistics(const Simulator *sim);
+static void print_sample_statistics(const sim_sample_stats_t *sample);
+static void print_window_statistics(const sim_window_stats_t *windows);
 
 
 int main(int argc, char **argv) {
     sim_config_t config = DEFAULT_SIM_CONFIG;
     int opt;
-    char trace_fn[512];
+    char trace_fn[512] = "";
+    std::vector<std::string> trace_fns;
+    const char *sweep_fn = NULL;
+    unsigned jobs = 0;
+    uint64_t stack_distance_max_c = 0;
+    const char *checkpoint_fn = NULL;
+    uint64_t checkpoint_every = 0;
+    const char *restore_fn = NULL;
+    uint64_t fork_at = 0;
+    uint64_t what_if = 0;
+    const char *l1i_spec = NULL;
+    /* Set by any option --stack-distance can't model */
+    bool beyond_lru_l1 = false;
+    static const struct option long_options[] = {
+        {"sweep", required_argument, NULL, OPT_SWEEP},
+        {"jobs", required_argument, NULL, OPT_JOBS},
+        {"stack-distance", optional_argument, NULL, OPT_STACK_DISTANCE},
+        {"sample-sets", required_argument, NULL, OPT_SAMPLE_SETS},
+        {"period", required_argument, NULL, OPT_PERIOD},
+        {"warmup", required_argument, NULL, OPT_WARMUP},
+        {"window", required_argument, NULL, OPT_WINDOW},
+        {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+        {"checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY},
+        {"restore", required_argument, NULL, OPT_RESTORE},
+        {"fork-at", required_argument, NULL, OPT_FORK_AT},
+        {"what-if", required_argument, NULL, OPT_WHAT_IF},
+        {"level", required_argument, NULL, OPT_LEVEL},
+        {"hierarchy", required_argument, NULL, OPT_HIERARCHY},
+        {"l1i", required_argument, NULL, OPT_L1I},
+        {"prefetch-stats", no_argument, NULL, OPT_PREFETCH_STATS},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
 
     /* Read arguments */
-    while(-1 != (opt = getopt(argc, argv, "c:b:s:f:r:C:S:I:P:Dh"))) {
+    while(-1 != (opt = getopt_long(argc, argv, OPTSTRING, long_options, NULL))) {
         switch(opt) {
-        case 'c':
-            config.l1_config.c = atoi(optarg);
+        case 'f':
+	    strncpy(trace_fn, optarg, 511);
+            trace_fns.push_back(optarg);
             break;
-        case 'b':
-            config.l1_config.b = atoi(optarg);
-            config.l2_config.b = config.l1_config.b;
+        case OPT_SWEEP:
+            sweep_fn = optarg;
             break;
-        case 's':
-            config.l1_config.s = atoi(optarg);
+        case OPT_JOBS:
+            if (atoi(optarg) < 1) {
+                printf("Invalid number of jobs `%s'\n", optarg);
+                return 1;
+            }
+            jobs = atoi(optarg);
             break;
-        case 'f':
-	    strncpy(trace_fn, optarg, 511);
+        case OPT_STACK_DISTANCE:
+            stack_distance_max_c = optarg ? strtoull(optarg, NULL, 10) : STACK_DISTANCE_MAX_C;
+            if (stack_distance_max_c < 1 || stack_distance_max_c > 40) {
+                printf("Invalid --stack-distance size `%s'\n", optarg);
+                return 1;
+            }
             break;
-        case 'r':
-            if (parse_replace_policy(optarg, &config.l2_config.replace_policy)) {
+        case OPT_SAMPLE_SETS:
+            config.sample_rate = atof(optarg);
+            if (!(config.sample_rate > 0 && config.sample_rate <= 1)) {
+                printf("Invalid --sample-sets rate `%s'\n", optarg);
                 return 1;
             }
-            config.l1_config.replace_policy = config.l2_config.replace_policy;
             break;
-        case 'C':
-            config.l2_config.c = atoi(optarg);
+        case OPT_PERIOD:
+            config.window_period = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_WARMUP:
+            config.window_warmup = strtoull(optarg, NULL, 10);
             break;
-        case 'S':
-            config.l2_config.s = atoi(optarg);
+        case OPT_WINDOW:
+            config.window_length = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_CHECKPOINT:
+            checkpoint_fn = optarg;
+            break;
+        case OPT_CHECKPOINT_EVERY:
+            checkpoint_every = strtoull(optarg, NULL, 10);
+            if (checkpoint_every < 1) {
+                printf("Invalid --checkpoint-every count `%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_RESTORE:
+            restore_fn = optarg;
+            break;
+        case OPT_FORK_AT:
+            fork_at = strtoull(optarg, NULL, 10);
+            break;
+        case OPT_WHAT_IF:
+            what_if = strtoull(optarg, NULL, 10);
+            if (what_if < 1) {
+                printf("Invalid --what-if count `%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case OPT_LEVEL:
+            if (add_level(optarg, &config)) {
+                return 1;
+            }
+            beyond_lru_l1 = true;
             break;
-        case 'I':
-            if (parse_insert_policy(optarg, &config.l2_config.prefetch_insert_policy)) {
+        case OPT_HIERARCHY:
+            if (load_hierarchy(optarg, &config)) {
                 return 1;
             }
+            beyond_lru_l1 = true;
             break;
-        case 'P':
-	    if (atoi(optarg) == 0) {
-            	config.l2_config.prefetcher_disabled = true;
-            	config.l2_config.prefetcher_disabled = true;
-	    } else if (atoi(optarg) == 1) {
-            	config.l2_config.prefetcher_disabled = false;
-            	config.l2_config.strided_prefetch_disabled = true;
-	    } else if (atoi(optarg) == 2) {
-            	config.l2_config.prefetcher_disabled = false;
-            	config.l2_config.strided_prefetch_disabled = false;
-	    } else {
-                    printf("Unknown prefetcher option `%s'\n", optarg);
-		    return 1;
-	    }
+        case OPT_L1I:
+            l1i_spec = optarg;
+            beyond_lru_l1 = true;
             break;
-        case 'D':
-            config.l2_config.disabled = true;
+        case OPT_PREFETCH_STATS:
+            config.prefetch_stats = true;
+            beyond_lru_l1 = true;
             break;
         case 'h':
-            /* Fall through */
-        default:
+        case '?':
             print_help();
             return 0;
+        default:
+            if (apply_option(opt, optarg, &config)) {
+                return 1;
+            }
+            if (!strchr("cbsrD", opt)) {
+                beyond_lru_l1 = true;
+            }
+            break;
+        }
+    }
+
+    if (l1i_spec) {
+        /* The L1I starts out like the (data) L1, so it is set up once all
+           the L1 options are in, wherever --l1i came among them */
+        config.l1i_config = config.l1_config;
+        config.l1i_config.disabled = false;
+        if (parse_level(l1i_spec, &config.l1i_config)) {
+            return 1;
         }
     }
 
@@ -83,49 +211,741 @@ int main(int argc, char **argv) {
 	    return 1;
     }
 
+    bool time_sampled = config.window_period || config.window_warmup || config.window_length;
+    if (time_sampled) {
+        if (!config.window_length || config.window_period < config.window_warmup + config.window_length) {
+            printf("ERROR: --window must be positive and --period at least --warmup plus --window\n");
+            return 1;
+        }
+        if (config.sample_rate < 1) {
+            printf("ERROR: --sample-sets can't be combined with --period/--warmup/--window\n");
+            return 1;
+        }
+    }
+
+    if ((config.num_outer_levels || !config.l1i_config.disabled || config.victim_entries) &&
+        (config.sample_rate < 1 || time_sampled)) {
+        printf("ERROR: --sample-sets and time sampling don't support --l1i, -V or levels below L2\n");
+        return 1;
+    }
+
+    if (checkpoint_every && !checkpoint_fn) {
+        printf("ERROR: --checkpoint-every needs --checkpoint\n");
+        return 1;
+    }
+    if ((checkpoint_fn || restore_fn) && (sweep_fn || (jobs && !what_if) || stack_distance_max_c)) {
+        printf("ERROR: --checkpoint and --restore work on single runs only\n");
+        return 1;
+    }
+    if ((what_if || fork_at) && (sweep_fn || stack_distance_max_c || checkpoint_fn || !what_if)) {
+        printf("ERROR: --fork-at needs --what-if, which can't be combined with --sweep, --stack-distance or --checkpoint\n");
+        return 1;
+    }
+
+    if (stack_distance_max_c) {
+        if (sweep_fn || jobs || trace_fns.size() > 1 || config.sample_rate < 1 || time_sampled) {
+            printf("ERROR: --stack-distance takes one trace and no --sweep, --jobs or sampling\n");
+            return 1;
+        }
+        if (beyond_lru_l1 || config.l1_config.replace_policy != REPLACE_POLICY_LRU) {
+            printf("ERROR: --stack-distance models an LRU L1 alone and takes no cache options but -c, -b, -s, -r lru and -D\n");
+            return 1;
+        }
+        if (validate_config(&config, true)) {
+            return 1;
+        }
+
+        trace_reader_t reader;
+        if (trace_open(trace_fn, &reader)) {
+            return 1;
+        }
+        int ret = run_stack_distance(&config.l1_config, &reader, stack_distance_max_c);
+        trace_close(&reader);
+        return ret;
+    }
+
+    if (sweep_fn) {
+        /* Every configuration of the sweep is fed from a single pass over the trace */
+        std::vector<sim_config_t> configs;
+        if (load_sweep(sweep_fn, &config, &configs)) {
+            return 1;
+        }
+
+        /* With several traces or --jobs, every (config, trace) pair becomes a job */
+        if (jobs || trace_fns.size() > 1) {
+            return run_parallel_sweep(&configs, trace_fns, jobs ? jobs : 1);
+        }
+
+        trace_reader_t reader;
+        if (trace_open(trace_fn, &reader)) {
+            return 1;
+        }
+
+        int ret = run_sweep(&configs, &reader);
+        trace_close(&reader);
+        return ret;
+    }
+
+    if (trace_fns.size() > 1 || (jobs && !what_if)) {
+        printf("ERROR: several traces and --jobs need --sweep\n");
+        return 1;
+    }
+
+    /* A restored run takes its configuration from the checkpoint */
+    Simulator sim;
+    uint64_t done = 0;
+    if (restore_fn) {
+        if (sim.load_checkpoint(restore_fn, &done)) {
+            return 1;
+        }
+        config = *sim.get_config();
+    }
+
     printf("Cache Settings\n");
     printf("--------------\n");
-    print_cache_config(&config.l1_config, "L1");
-    print_cache_config(&config.l2_config, "L2");
+    print_hierarchy_config(&config);
     printf("\n");
 
-    if (validate_config(&config)) {
+    if (validate_config(&config, true)) {
         return 1;
     }
 
-    /* Setup the cache */
-    sim_setup(&config);
-
-    /* Setup statistics */
-    sim_stats_t stats;
-    memset(&stats, 0, sizeof stats);
+    /* Setup the cache and its statistics */
+    if (!restore_fn) {
+        sim.setup(&config);
+    }
 
     /* Begin reading the file */
-    char rw;
-    uint64_t address;
+    trace_reader_t reader;
+    if (trace_open(trace_fn, &reader)) {
+        return 1;
+    }
+    if (trace_skip(&reader, done) != done) {
+        printf("ERROR: %s ends before the %" PRIu64 " records of checkpoint %s\n", trace_fn, done, restore_fn);
+        trace_close(&reader);
+        return 1;
+    }
 
-    FILE *f;
-    f = fopen(trace_fn, "r");
+    const uint64_t *addrs;
+    const uint8_t *rws;
+    size_t count;
+    if (what_if) {
+        /* Simulate up to the fork point once, then each what-if from a copy */
+        if (fork_at < done) {
+            printf("ERROR: --fork-at %" PRIu64 " is before the checkpoint at %" PRIu64 "\n", fork_at, done);
+            trace_close(&reader);
+            return 1;
+        }
+        while (done < fork_at && (count = trace_next(&reader, &addrs, &rws, std::min(fork_at - done, (uint64_t)TRACE_CHUNK)))) {
+            sim.access_batch(addrs, rws, count);
+            done += count;
+        }
+        if (!reader.failed && done < fork_at) {
+            printf("ERROR: --fork-at %" PRIu64 " is past the end of %s (%" PRIu64 " records)\n", fork_at, trace_fn, done);
+            trace_close(&reader);
+            return 1;
+        }
+        int ret = reader.failed ? 1 : run_what_if(&sim, &reader, what_if, jobs ? jobs : 1);
+        trace_close(&reader);
+        return ret;
+    }
+    while ((count = trace_next(&reader, &addrs, &rws, TRACE_CHUNK))) {
+        if (replay_checkpointed(&sim, addrs, rws, count, &done, checkpoint_fn, checkpoint_every)) {
+            trace_close(&reader);
+            return 1;
+        }
+    }
+    trace_close(&reader);
+    if (reader.failed) {
+        return 1;
+    }
+    if (checkpoint_fn && sim.save_checkpoint(checkpoint_fn, done)) {
+        return 1;
+    }
+
+    sim.finish();
+
+    print_statistics(sim.get_stats(), !config.l1i_config.disabled);
+    print_level_statistics(&sim);
+    if (config.sample_rate < 1) {
+        printf("\n");
+        if (sim.get_sample_stats()) {
+            print_sample_statistics(sim.get_sample_stats());
+        } else {
+            printf("Set sampling: not possible with a single-set cache, simulated exactly\n");
+        }
+    }
+    if (sim.get_window_stats()) {
+        printf("\n");
+        print_window_statistics(sim.get_window_stats());
+    }
 
+    return 0;
+}
+
+// Apply one cache parameter option (anything but -f and -h) to config
+static int apply_option(int opt, const char *arg, sim_config_t *config) {
+    switch(opt) {
+    case 'c':
+        config->l1_config.c = atoi(arg);
+        break;
+    case 'b':
+        config->l1_config.b = atoi(arg);
+        config->l2_config.b = config->l1_config.b;
+        config->l1i_config.b = config->l1_config.b;
+        for (uint64_t i = 0; i < config->num_outer_levels; i++) {
+            config->outer_configs[i].b = config->l1_config.b;
+        }
+        break;
+    case 's':
+        config->l1_config.s = atoi(arg);
+        break;
+    case 'r':
+        if (parse_replace_policy(arg, &config->l2_config.replace_policy)) {
+            return 1;
+        }
+        config->l1_config.replace_policy = config->l2_config.replace_policy;
+        config->l1i_config.replace_policy = config->l2_config.replace_policy;
+        for (uint64_t i = 0; i < config->num_outer_levels; i++) {
+            config->outer_configs[i].replace_policy = config->l2_config.replace_policy;
+        }
+        break;
+    case 'C':
+        config->l2_config.c = atoi(arg);
+        break;
+    case 'S':
+        config->l2_config.s = atoi(arg);
+        break;
+    case 'I':
+        if (parse_insert_policy(arg, &config->l2_config.prefetch_insert_policy)) {
+            return 1;
+        }
+        break;
+    case 'P':
+        if (parse_prefetcher(arg, &config->l2_config)) {
+            return 1;
+        }
+        break;
+    case 'G':
+        config->l2_config.prefetch_degree = strtoull(arg, NULL, 10);
+        break;
+    case 'A':
+        config->l2_config.prefetch_distance = strtoull(arg, NULL, 10);
+        break;
+    case 'X':
+        if (parse_inclusion_policy(arg, &config->l2_config.inclusion)) {
+            return 1;
+        }
+        break;
+    case 'V':
+        config->victim_entries = strtoull(arg, NULL, 10);
+        break;
+    case 'w':
+        if (parse_write_strat(arg, &config->l1_config.write_strat)) {
+            return 1;
+        }
+        break;
+    case 'W':
+        if (parse_write_strat(arg, &config->l2_config.write_strat)) {
+            return 1;
+        }
+        break;
+    case 'M':
+        config->write_buffer_depth = strtoull(arg, NULL, 10);
+        break;
+    case 'D':
+        config->l2_config.disabled = true;
+        break;
+    default:
+        printf("Unknown option `-%c'\n", opt);
+        return 1;
+    }
+    return 0;
+}
+
+// Apply a level spec such as "c=20,s=4,w=wbwa,t=10:0.5:0.5" to level. Keys:
+// c and s as -c/-s, p, g, a, i and x as -P/-G/-A/-I/-X, w the write strategy
+// (wbwa, wtwna, wbwna or wtwa) and t the hit time model
+// base:per_index_bit:per_way_bit.
+static int parse_level(const char *spec, cache_config_t *level) {
+    std::string all(spec);
+    size_t start = 0;
+    while (start < all.size()) {
+        size_t comma = all.find(',', start);
+        if (comma == std::string::npos) {
+            comma = all.size();
+        }
+        std::string item = all.substr(start, comma - start);
+        start = comma + 1;
+        size_t eq = item.find('=');
+        if (item.empty()) {
+            continue;
+        }
+        if (eq != 1) {
+            printf("Invalid level setting `%s'\n", item.c_str());
+            return 1;
+        }
+        const char *value = item.c_str() + 2;
+        switch (item[0]) {
+        case 'c':
+            level->c = atoi(value);
+            break;
+        case 's':
+            level->s = atoi(value);
+            break;
+        case 'p':
+            if (parse_prefetcher(value, level)) {
+                return 1;
+            }
+            break;
+        case 'g':
+            level->prefetch_degree = strtoull(value, NULL, 10);
+            break;
+        case 'a':
+            level->prefetch_distance = strtoull(value, NULL, 10);
+            break;
+        case 'i':
+            if (parse_insert_policy(value, &level->prefetch_insert_policy)) {
+                return 1;
+            }
+            break;
+        case 'x':
+            if (parse_inclusion_policy(value, &level->inclusion)) {
+                return 1;
+            }
+            break;
+        case 'w':
+            if (parse_write_strat(value, &level->write_strat)) {
+                return 1;
+            }
+            break;
+        case 't':
+            if (sscanf(value, "%lf:%lf:%lf", &level->hit_time.base, &level->hit_time.per_index_bit,
+                       &level->hit_time.per_way_bit) != 3) {
+                printf("Invalid hit time model `%s'\n", value);
+                return 1;
+            }
+            break;
+        default:
+            printf("Invalid level setting `%s'\n", item.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Append a level below the last one. It starts as a copy of the level
+// above with its prefetcher off and write-back, write-allocate.
+static int add_level(const char *spec, sim_config_t *config) {
+    if (config->num_outer_levels == SIM_MAX_LEVELS - 2) {
+        printf("ERROR: at most %" PRIu64 " cache levels\n", SIM_MAX_LEVELS);
+        return 1;
+    }
+    const cache_config_t *above = config->num_outer_levels
+        ? &config->outer_configs[config->num_outer_levels - 1]
+        : &config->l2_config;
+    cache_config_t *level = &config->outer_configs[config->num_outer_levels++];
+    *level = *above;
+    level->prefetcher_disabled = true;
+    level->write_strat = WRITE_STRAT_WBWA;
+    return parse_level(spec, level);
+}
+
+// Read a hierarchy file: one level spec per line as for --level, L1
+// first. The first two lines adjust L1 and L2, later lines add levels.
+static int load_hierarchy(const char *hierarchy_fn, sim_config_t *config) {
+    FILE *f = fopen(hierarchy_fn, "r");
     if (!f) {
-	    printf("ERROR: can't open file %s\n", trace_fn);
-	    fflush(stdout);
-	    return 1;
+        printf("ERROR: can't open hierarchy file %s\n", hierarchy_fn);
+        return 1;
+    }
+
+    char line[1024];
+    int line_no = 0;
+    int levels = 0;
+    int ret = 0;
+    config->num_outer_levels = 0;
+    while (!ret && fgets(line, sizeof line, f)) {
+        line_no++;
+        char *end = line + strcspn(line, "#\r\n");
+        *end = '\0';
+        char *spec = line + strspn(line, " \t");
+        for (char *p = spec; *p; p++) {
+            if (isspace((unsigned char)*p)) {
+                *p = ',';
+            }
+        }
+        if (!*spec) {
+            continue;
+        }
+        if (levels == 0) {
+            ret = parse_level(spec, &config->l1_config);
+        } else if (levels == 1) {
+            config->l2_config.disabled = false;
+            ret = parse_level(spec, &config->l2_config);
+        } else {
+            ret = add_level(spec, config);
+        }
+        levels++;
+        if (ret) {
+            printf("ERROR: %s:%d: invalid level\n", hierarchy_fn, line_no);
+        }
     }
+    fclose(f);
+    return ret;
+}
+
+// One option of a sweep line together with every value it should take
+typedef struct sweep_axis
+{
+    int opt;
+    std::vector<std::string> values;
+} sweep_axis_t;
 
-    while (!feof(f)) {   
-        int ret = fscanf(f, "%c 0x%" PRIx64 "\n", &rw, &address);
-        if(ret == 2) {
-            sim_access(rw, address, &stats);
+// Split a sweep value such as "lip,mip" or "5..7" into its values
+static int expand_sweep_values(const char *spec, std::vector<std::string> *values) {
+    std::string all(spec);
+    size_t start = 0;
+    while (start <= all.size()) {
+        size_t comma = all.find(',', start);
+        if (comma == std::string::npos) {
+            comma = all.size();
         }
+        std::string item = all.substr(start, comma - start);
+        size_t dots = item.find("..");
+        if (dots != std::string::npos) {
+            int lo = atoi(item.substr(0, dots).c_str());
+            int hi = atoi(item.substr(dots + 2).c_str());
+            if (lo > hi) {
+                printf("Invalid sweep range `%s'\n", item.c_str());
+                return 1;
+            }
+            for (int v = lo; v <= hi; v++) {
+                values->push_back(std::to_string(v));
+            }
+        } else if (!item.empty()) {
+            values->push_back(item);
+        }
+        start = comma + 1;
     }
+    return 0;
+}
 
-    sim_finish(&stats);
+// Append the cartesian product of axes[i..] applied on top of config
+static int expand_sweep_axes(const std::vector<sweep_axis_t> &axes, size_t i, sim_config_t config,
+                             std::vector<sim_config_t> *configs, uint64_t *skipped) {
+    if (i == axes.size()) {
+        if (validate_config(&config, false)) {
+            (*skipped)++;
+        } else {
+            configs->push_back(config);
+        }
+        return 0;
+    }
+    for (size_t v = 0; v < axes[i].values.size(); v++) {
+        sim_config_t next = config;
+        const char *arg = axes[i].values[v].empty() ? NULL : axes[i].values[v].c_str();
+        if (apply_option(axes[i].opt, arg, &next)) {
+            return 1;
+        }
+        if (expand_sweep_axes(axes, i + 1, next, configs, skipped)) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    print_statistics(&stats);
+// Read a sweep file. Each line holds cache options like the command line,
+// e.g. "-b 5..7 -s 0..5 -I lip,mip -r lfu,lru", and is expanded into every
+// combination of its values on top of the base configuration. Invalid
+// combinations are skipped.
+static int load_sweep(const char *sweep_fn, const sim_config_t *base, std::vector<sim_config_t> *configs) {
+    FILE *f = fopen(sweep_fn, "r");
+    if (!f) {
+        printf("ERROR: can't open sweep file %s\n", sweep_fn);
+        return 1;
+    }
 
+    char line[1024];
+    int line_no = 0;
+    uint64_t skipped = 0;
+    while (fgets(line, sizeof line, f)) {
+        line_no++;
+        std::vector<sweep_axis_t> axes;
+        char *save = NULL;
+        for (char *tok = strtok_r(line, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+            if (tok[0] == '#') {
+                break;
+            }
+            const char *spec = (tok[0] == '-' && tok[1] && !tok[2]) ? strchr(OPTSTRING, tok[1]) : NULL;
+            if (!spec || tok[1] == 'f' || tok[1] == 'h' || tok[1] == ':') {
+                printf("ERROR: %s:%d: unexpected `%s'\n", sweep_fn, line_no, tok);
+                fclose(f);
+                return 1;
+            }
+            sweep_axis_t axis;
+            axis.opt = tok[1];
+            if (spec[1] == ':') {
+                char *value = strtok_r(NULL, " \t\r\n", &save);
+                if (!value || expand_sweep_values(value, &axis.values) || axis.values.empty()) {
+                    printf("ERROR: %s:%d: missing value for `%s'\n", sweep_fn, line_no, tok);
+                    fclose(f);
+                    return 1;
+                }
+            } else {
+                axis.values.push_back("");
+            }
+            axes.push_back(axis);
+        }
+        if (axes.empty()) {
+            continue;
+        }
+        if (expand_sweep_axes(axes, 0, *base, configs, &skipped)) {
+            printf("ERROR: %s:%d: bad sweep line\n", sweep_fn, line_no);
+            fclose(f);
+            return 1;
+        }
+    }
     fclose(f);
 
+    if (skipped) {
+        printf("Skipped %" PRIu64 " invalid configurations\n\n", skipped);
+    }
+    if (configs->empty()) {
+        printf("ERROR: sweep file %s has no valid configurations\n", sweep_fn);
+        return 1;
+    }
+    return 0;
+}
+
+// Replay records, done of which came before them in the trace, saving a
+// checkpoint after every checkpoint_every records of the trace (0 = never)
+static int replay_checkpointed(Simulator *sim, const uint64_t *addrs, const uint8_t *rws, size_t count, uint64_t *done,
+                               const char *checkpoint_fn, uint64_t checkpoint_every) {
+    while (count) {
+        size_t n = count;
+        if (checkpoint_every) {
+            n = std::min((uint64_t)count, checkpoint_every - *done % checkpoint_every);
+        }
+        sim->access_batch(addrs, rws, n);
+        *done += n;
+        addrs += n;
+        rws += n;
+        count -= n;
+        if (checkpoint_every && *done % checkpoint_every == 0 && sim->save_checkpoint(checkpoint_fn, *done)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Simulate every configuration against one pass over the trace. Records are
+// read a chunk at a time and each hierarchy replays the chunk in turn.
+static int run_sweep(std::vector<sim_config_t> *configs, trace_reader_t *reader) {
+    size_t num_configs = configs->size();
+    std::vector<Simulator> sims(num_configs);
+
+    for (size_t i = 0; i < num_configs; i++) {
+        sims[i].setup(&(*configs)[i]);
+    }
+
+    const uint64_t *addrs;
+    const uint8_t *rws;
+    size_t count;
+    while ((count = trace_next(reader, &addrs, &rws, TRACE_CHUNK))) {
+        for (size_t i = 0; i < num_configs; i++) {
+            sims[i].access_batch(addrs, rws, count);
+        }
+    }
+    if (reader->failed) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < num_configs; i++) {
+        sims[i].finish();
+
+        if (i) {
+            printf("\n");
+        }
+        print_run(&(*configs)[i], &sims[i]);
+    }
+    return 0;
+}
+
+// Print LRU miss counts and AAT for every L1 (C,S) at the configured block
+// size, C up to max_c, from one stack-distance pass over the trace. Matches
+// running each config with -P 0 -D.
+static int run_stack_distance(const cache_config_t *l1_config, trace_reader_t *reader, uint64_t max_c) {
+    uint64_t b = l1_config->b;
+    if (max_c < b) {
+        printf("ERROR: --stack-distance size %" PRIu64 " is smaller than a block (B = %" PRIu64 ")\n", max_c, b);
+        return 1;
+    }
+
+    StackDistance stack_distance(b, max_c - b);
+    const uint64_t *addrs;
+    const uint8_t *rws;
+    size_t count;
+    while ((count = trace_next(reader, &addrs, &rws, TRACE_CHUNK))) {
+        stack_distance.access_batch(addrs, count);
+    }
+    if (reader->failed) {
+        return 1;
+    }
+
+    uint64_t accesses = stack_distance.accesses();
+    printf("LRU stack distance, B = %" PRIu64 ", no prefetching, L2 disabled\n", b);
+    printf("Accesses: %" PRIu64 "\n\n", accesses);
+    printf("%3s %3s %12s %10s %9s\n", "C", "S", "Misses", "Miss ratio", "AAT");
+    for (uint64_t c = b; c <= max_c; c++) {
+        for (uint64_t s = 0; s <= c - b; s++) {
+            uint64_t misses = stack_distance.misses(c - b - s, s);
+            double miss_ratio = accesses ? (double)misses / accesses : 0;
+            cache_config_t l1 = *l1_config;
+            l1.c = c;
+            l1.s = s;
+            double hit_time = cacheHitTime(&l1);
+            printf("%3" PRIu64 " %3" PRIu64 " %12" PRIu64 " %10.3f %9.3f\n",
+                   c, s, misses, miss_ratio, hit_time + miss_ratio * DRAM_ACCESS_TIME);
+        }
+    }
+    return 0;
+}
+
+// Read a whole trace into memory
+static int load_trace(const char *trace_fn, trace_buffer_t *trace) {
+    trace->name = trace_fn;
+    trace_reader_t reader;
+    if (trace_open(trace_fn, &reader)) {
+        return 1;
+    }
+
+    const uint64_t *addrs;
+    const uint8_t *rws;
+    size_t count;
+    while ((count = trace_next(&reader, &addrs, &rws, TRACE_CHUNK))) {
+        trace->addrs.insert(trace->addrs.end(), addrs, addrs + count);
+        trace->rws.insert(trace->rws.end(), rws, rws + count);
+    }
+    trace_close(&reader);
+    return reader.failed ? 1 : 0;
+}
+
+// Simulate every (configuration, trace) pair on a work-stealing pool of
+// threads. Each trace is loaded once and shared by all of its jobs, and each
+// job gets its own Simulator. Every job is reported as run_sweep() reports a
+// configuration, then all of them once more in one table.
+static int run_parallel_sweep(std::vector<sim_config_t> *configs, const std::vector<std::string> &trace_fns, unsigned jobs) {
+    std::vector<trace_buffer_t> traces(trace_fns.size());
+    for (size_t t = 0; t < trace_fns.size(); t++) {
+        if (load_trace(trace_fns[t].c_str(), &traces[t])) {
+            return 1;
+        }
+    }
+
+    size_t num_configs = configs->size();
+    std::vector<Simulator> sims(num_configs * traces.size());
+    std::vector<sim_stats_t> results(sims.size());
+    run_work_stealing(sims.size(), jobs, [&](size_t job) {
+        const trace_buffer_t &trace = traces[job / num_configs];
+        sims[job].setup(&(*configs)[job % num_configs]);
+        sims[job].access_batch(trace.addrs.data(), trace.rws.data(), trace.addrs.size());
+        sims[job].finish();
+        results[job] = *sims[job].get_stats();
+    });
+
+    for (size_t job = 0; job < sims.size(); job++) {
+        if (traces.size() > 1) {
+            printf("Trace: %s\n\n", traces[job / num_configs].name.c_str());
+        }
+        print_run(&(*configs)[job % num_configs], &sims[job]);
+        printf("\n");
+    }
+    print_sweep_table(*configs, traces, results);
+    return 0;
+}
+
+// Simulate the next num_records records once for every L2 prefetcher and
+// insertion policy, each on its own copy of the warm state of base, and
+// compare what they did over those records
+static int run_what_if(const Simulator *base, trace_reader_t *reader, uint64_t num_records, unsigned jobs) {
+    const sim_config_t *base_config = base->get_config();
+    if (base_config->l2_config.disabled) {
+        printf("ERROR: --what-if compares L2 prefetchers and needs L2\n");
+        return 1;
+    }
+
+    std::vector<uint64_t> addrs;
+    std::vector<uint8_t> rws;
+    const uint64_t *chunk_addrs;
+    const uint8_t *chunk_rws;
+    size_t count;
+    while (addrs.size() < num_records &&
+           (count = trace_next(reader, &chunk_addrs, &chunk_rws,
+                               std::min(num_records - addrs.size(), (uint64_t)TRACE_CHUNK)))) {
+        addrs.insert(addrs.end(), chunk_addrs, chunk_addrs + count);
+        rws.insert(rws.end(), chunk_rws, chunk_rws + count);
+    }
+    if (reader->failed) {
+        return 1;
+    }
+    if (addrs.empty()) {
+        printf("ERROR: %s has no records left after --fork-at\n", reader->name.c_str());
+        return 1;
+    }
+
+    static const char *const prefetchers[] = {"0", "1", "2", "3", "4", "5", "6", "7"};
+    static const char *const inserts[] = {"mip", "lip"};
+    std::vector<sim_config_t> configs;
+    for (size_t p = 0; p < sizeof prefetchers / sizeof prefetchers[0]; p++) {
+        for (size_t i = 0; i < 2; i++) {
+            sim_config_t config = *base_config;
+            apply_option('P', prefetchers[p], &config);
+            apply_option('I', inserts[i], &config);
+            /* Without a prefetcher the insertion policy makes no difference */
+            if (config.l2_config.prefetcher_disabled && i > 0) {
+                continue;
+            }
+            configs.push_back(config);
+        }
+    }
+
+    std::vector<sim_stats_t> results(configs.size());
+    std::vector<int> failed(configs.size(), 0);
+    run_work_stealing(configs.size(), jobs, [&](size_t job) {
+        Simulator sim;
+        if (sim.clone_from(*base, &configs[job])) {
+            failed[job] = 1;
+            return;
+        }
+        sim.reset_stats();
+        sim.access_batch(addrs.data(), rws.data(), addrs.size());
+        sim.finish();
+        results[job] = *sim.get_stats();
+    });
+    for (size_t job = 0; job < configs.size(); job++) {
+        if (failed[job]) {
+            return 1;
+        }
+    }
+
+    std::vector<trace_buffer_t> traces(1);
+    traces[0].name = reader->name;
+    print_sweep_table(configs, traces, results);
+    return 0;
+}
+
+// Set the prefetcher of level from a -P value: 0 none, 1 +1, 2 strided,
+// 3 stream, 4 GHB, 5 delta correlation, 6 best offset or 7 stride table
+static int parse_prefetcher(const char *arg, cache_config_t *level) {
+    int kind = atoi(arg);
+    if (kind < PREFETCH_NONE || kind > PREFETCH_STRIDE_TABLE) {
+        printf("Unknown prefetcher option `%s'\n", arg);
+        return 1;
+    }
+    level->prefetcher_disabled = kind == PREFETCH_NONE;
+    level->strided_prefetch_disabled = kind != PREFETCH_STRIDED;
+    level->prefetch_kind = kind > PREFETCH_STRIDED ? (prefetch_kind_t)kind : PREFETCH_NONE;
     return 0;
 }
 
@@ -155,6 +975,36 @@ static int parse_insert_policy(const char *arg, insert_policy_t *policy_out) {
     }
 }
 
+static int parse_inclusion_policy(const char *arg, inclusion_policy_t *policy_out) {
+    if (!strcmp(arg, "nine") || !strcmp(arg, "NINE")) {
+        *policy_out = INCLUSION_NINE;
+    } else if (!strcmp(arg, "inclusive") || !strcmp(arg, "inc")) {
+        *policy_out = INCLUSION_INCLUSIVE;
+    } else if (!strcmp(arg, "exclusive") || !strcmp(arg, "exc")) {
+        *policy_out = INCLUSION_EXCLUSIVE;
+    } else {
+        printf("Unknown inclusion policy `%s'\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+static int parse_write_strat(const char *arg, write_strat_t *strat_out) {
+    if (!strcmp(arg, "wbwa") || !strcmp(arg, "WBWA")) {
+        *strat_out = WRITE_STRAT_WBWA;
+    } else if (!strcmp(arg, "wtwna") || !strcmp(arg, "WTWNA")) {
+        *strat_out = WRITE_STRAT_WTWNA;
+    } else if (!strcmp(arg, "wbwna") || !strcmp(arg, "WBWNA")) {
+        *strat_out = WRITE_STRAT_WBWNA;
+    } else if (!strcmp(arg, "wtwa") || !strcmp(arg, "WTWA")) {
+        *strat_out = WRITE_STRAT_WTWA;
+    } else {
+        printf("Unknown write strategy `%s'\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
 static void print_help(void) {
     printf("cachesim [OPTIONS] < traces/file.trace\n");
     printf("-h\t\tThis helpful output\n");
@@ -162,6 +1012,9 @@ static void print_help(void) {
     printf("  -c C1\t\tTotal size for L1 in bytes is 2^C1\n");
     printf("  -b B1\t\tSize of each block for L1 in bytes is 2^B1\n");
     printf("  -s S1\t\tNumber of blocks per set for L1 is 2^S1\n");
+    printf("  --l1i SPEC\tSplit L1: send instruction fetches ('I' records) to an L1I set up\n");
+    printf("\t\tby SPEC (c, s and t as for --level; unset keys copy L1). Without it\n");
+    printf("\t\tfetches are reads of the unified L1.\n");
     printf("L1 & L2 parameters:\n");
     printf("  -f <tracefile>\t\tTrace filename\n");
     printf("  -r r12\t\tReplacement policy for both L1 and L2 (lru or lfu)\n");
@@ -169,26 +1022,169 @@ static void print_help(void) {
     printf("  -C C2\t\tTotal size in bytes for L2 is 2^C1\n");
     printf("  -S S2\t\tNumber of blocks per set for L2 is 2^S1\n");
     printf("  -I I2\t\tInsertion policy for L2 prefetching (mip or lip)\n");
-    printf("  -P <0,1,2> \t\tPrefetcher: 0 is no prefetch, 1 is +1 prefetch, and 2 is strided.\n");
+    printf("  -P <0-7> \t\tPrefetcher: 0 is no prefetch, 1 is +1 prefetch, 2 is strided, 3 is\n");
+    printf("\t\tstream, 4 is GHB (address correlation), 5 is delta correlation, 6 is\n");
+    printf("\t\tbest offset and 7 is a stride table with one stride per 4 KiB region.\n");
+    printf("\t\t3-7 train on L2 demand misses, 7 also on hits to blocks it prefetched.\n");
+    printf("  -G G2\t\tPrefetch degree: blocks prefetched per miss (default 1, at most %" PRIu64 ")\n",
+           PREFETCH_MAX_DEGREE);
+    printf("  -A A2\t\tPrefetch distance: how far ahead the first prefetched block is, in\n");
+    printf("\t\tblocks, strides or deltas (default 1, at most %" PRIu64 ")\n", PREFETCH_MAX_DISTANCE);
+    printf("  --prefetch-stats\tReport the accuracy (useful prefetches per prefetch), coverage\n");
+    printf("\t\t(useful prefetches per read that missed or would have) and pollution\n");
+    printf("\t\t(read misses to blocks prefetches evicted) of every prefetching level\n");
+    printf("  -X X2\t\tInclusion of L1 in L2: nine (default), inclusive (L2 evictions\n");
+    printf("\t\tback-invalidate L1) or exclusive (L1 victims move to L2, L2 hits to L1)\n");
     printf("  -D   \t\tDisable L2 cache\n");
+    printf("Write policy:\n");
+    printf("  -w W1, -W W2\tWrite strategy of L1 (default wbwa) and L2 (default wtwna): wbwa,\n");
+    printf("\t\twtwna, wbwna (write-back, write misses bypass) or wtwa (write-through,\n");
+    printf("\t\twrite misses allocate)\n");
+    printf("  -M M\t\tCoalesce writes to DRAM in an M entry write buffer (default 0, none)\n");
+    printf("Victim cache:\n");
+    printf("  -V V\t\tKeep the last V blocks evicted from L1 (data) in a fully associative\n");
+    printf("\t\tLRU victim cache probed on L1 misses before L2 (default 0, none)\n");
+    printf("Sweep mode:\n");
+    printf("  --sweep <file>\tSimulate every configuration listed in <file> in one pass over the trace.\n");
+    printf("\t\tEach line holds options as above; values may be lists or ranges, e.g.\n");
+    printf("\t\t  -b 5..7 -s 0..5 -I lip,mip -r lfu,lru\n");
+    printf("  --jobs N\tRun the sweep on N threads, printing each run as --sweep does and then\n");
+    printf("\t\tall of them in one results table.\n");
+    printf("\t\t-f may then be given several times to sweep several traces.\n");
+    printf("Miss-ratio curves:\n");
+    printf("  --stack-distance[=C]\tPrint LRU misses and AAT of every L1 size and associativity\n");
+    printf("\t\tat block size -b, up to 2^C bytes (default %" PRIu64 "), from one pass over the\n", STACK_DISTANCE_MAX_C);
+    printf("\t\ttrace. Models -P 0 -D, so takes no cache options but -c, -b, -s,\n");
+    printf("\t\t-r lru and -D.\n");
+    printf("Approximate simulation:\n");
+    printf("  --sample-sets R\tSimulate only a hashed fraction R (0 < R <= 1) of the cache sets\n");
+    printf("\t\tand scale the statistics up, printing 95%% confidence intervals.\n");
+    printf("\t\tApplies to --sweep runs too.\n");
+    printf("  --period N --warmup W --window L\n");
+    printf("\t\tTime sampling: in every N accesses, fast-forward the first N-W-L updating\n");
+    printf("\t\tonly the tags, simulate the next W unmeasured and measure the last L.\n");
+    printf("\t\tStatistics cover the measured windows, with their per-window variance.\n");
+    printf("Checkpoints:\n");
+    printf("  --checkpoint <file>\tSave the whole simulator state to <file> at the end of the\n");
+    printf("\t\ttrace, and with --checkpoint-every N after every N records.\n");
+    printf("  --restore <file>\tResume the run saved in <file>: its configuration and state are\n");
+    printf("\t\tloaded and the records it has seen are skipped.\n");
+    printf("What-if runs:\n");
+    printf("  --fork-at M --what-if N\tSimulate the first M records (or resume with --restore)\n");
+    printf("\t\tonce, then the next N records with every L2 prefetcher and insertion\n");
+    printf("\t\tpolicy, each from a copy of that warm state. --jobs runs them in parallel.\n");
+    printf("Deeper hierarchies:\n");
+    printf("  --level SPEC\tAdd a cache level below the last one (L3, L4, ...), e.g.\n");
+    printf("\t\t  c=20,s=4,p=0,i=lip,w=wbwa,t=10:0.5:0.5\n");
+    printf("\t\tc and s as -C/-S, p, g, a, i and x as -P/-G/-A/-I/-X, w the write strategy as -W\n");
+    printf("\t\tand t the hit time base:per_index_bit:per_way_bit. Unset keys copy the level\n");
+    printf("\t\tabove, with no prefetcher and wbwa. -b and -r apply to every level.\n");
+    printf("  --hierarchy <file>\tOne level spec per line, L1 first; the first two lines adjust\n");
+    printf("\t\tL1 and L2 and the rest add levels.\n");
 }
 
-static int validate_config(sim_config_t *config) {
+static int validate_config(sim_config_t *config, bool verbose) {
     if (config->l1_config.b > 7 || config->l1_config.b < 4) {
-        printf("Invalid configuration! The block size must be reasonable: 4 <= B <= 7\n");
+        if (verbose) {
+            printf("Invalid configuration! The block size must be reasonable: 4 <= B <= 7\n");
+        }
         return 1;
     }
 
     if (!config->l2_config.disabled && config->l1_config.s > config->l2_config.s) {
-        printf("Invalid configuration! L1 associativity must be less than or equal to L2 associativity\n");
+        if (verbose) {
+            printf("Invalid configuration! L1 associativity must be less than or equal to L2 associativity\n");
+        }
         return 1;
     }
 
     if (!config->l2_config.disabled && config->l1_config.c >= config->l2_config.c) {
-        printf("Invalid configuration! L1 size must be strictly less than L2 size\n");
+        if (verbose) {
+            printf("Invalid configuration! L1 size must be strictly less than L2 size\n");
+        }
+        return 1;
+    }
+
+    const cache_config_t *l1i = &config->l1i_config;
+    if (!l1i->disabled && !config->l2_config.disabled &&
+        (l1i->s > config->l2_config.s || l1i->c >= config->l2_config.c)) {
+        if (verbose) {
+            printf("Invalid configuration! L1I must be smaller than L2 and at most as associative\n");
+        }
+        return 1;
+    }
+
+    if (!l1i->disabled && l1i->c < l1i->b + l1i->s) {
+        if (verbose) {
+            printf("Invalid configuration! L1I must hold at least one set\n");
+        }
+        return 1;
+    }
+
+    if (config->victim_entries > VICTIM_MAX_ENTRIES ||
+        (config->victim_entries && config->l2_config.disabled)) {
+        if (verbose) {
+            printf("Invalid configuration! The victim cache needs L2 and at most %" PRIu64 " entries\n",
+                   VICTIM_MAX_ENTRIES);
+        }
+        return 1;
+    }
+
+    if (config->write_buffer_depth > WRITE_BUFFER_MAX_DEPTH) {
+        if (verbose) {
+            printf("Invalid configuration! The write buffer holds at most %" PRIu64 " entries\n",
+                   WRITE_BUFFER_MAX_DEPTH);
+        }
+        return 1;
+    }
+
+    for (uint64_t i = 0; i <= config->num_outer_levels; i++) {
+        const cache_config_t *level = i ? &config->outer_configs[i - 1] : &config->l2_config;
+        if (level->prefetch_degree < 1 || level->prefetch_degree > PREFETCH_MAX_DEGREE ||
+            level->prefetch_distance < 1 || level->prefetch_distance > PREFETCH_MAX_DISTANCE) {
+            if (verbose) {
+                printf("Invalid configuration! The prefetch degree must be 1 to %" PRIu64
+                       " and the distance 1 to %" PRIu64 "\n", PREFETCH_MAX_DEGREE, PREFETCH_MAX_DISTANCE);
+            }
+            return 1;
+        }
+    }
+
+    if (config->num_outer_levels && config->l2_config.disabled) {
+        if (verbose) {
+            printf("Invalid configuration! Levels below L2 need L2\n");
+        }
         return 1;
     }
 
+    // Data moves up out of an exclusive level, which only a write-back level
+    // above can keep
+    const cache_config_t *above = &config->l1_config;
+    for (uint64_t i = 0; !config->l2_config.disabled && i <= config->num_outer_levels; i++) {
+        const cache_config_t *level = i ? &config->outer_configs[i - 1] : &config->l2_config;
+        if (level->inclusion == INCLUSION_EXCLUSIVE && above->write_strat != WRITE_STRAT_WBWA &&
+            above->write_strat != WRITE_STRAT_WBWNA) {
+            if (verbose) {
+                printf("Invalid configuration! The level above exclusive L%" PRIu64 " must be write-back\n", i + 2);
+            }
+            return 1;
+        }
+        above = level;
+    }
+
+    above = &config->l2_config;
+    for (uint64_t i = 0; i < config->num_outer_levels; i++) {
+        const cache_config_t *level = &config->outer_configs[i];
+        if (level->c <= above->c || level->s < above->s || level->c < level->b + level->s) {
+            if (verbose) {
+                printf("Invalid configuration! L%" PRIu64 " must be larger than L%" PRIu64 " and at least as associative\n",
+                       i + 3, i + 2);
+            }
+            return 1;
+        }
+        above = level;
+    }
+
     return 0;
 }
 
@@ -208,7 +1204,39 @@ static const char *insert_policy_str(insert_policy_t policy) {
     }
 }
 
-static void print_cache_config(cache_config_t *cache_config, const char *cache_name) {
+static const char *inclusion_policy_str(inclusion_policy_t policy) {
+    switch (policy) {
+        case INCLUSION_INCLUSIVE: return "Inclusive";
+        case INCLUSION_EXCLUSIVE: return "Exclusive";
+        default: return "NINE";
+    }
+}
+
+static const char *write_strat_str(write_strat_t strat) {
+    switch (strat) {
+        case WRITE_STRAT_WBWA: return "Write-back";
+        case WRITE_STRAT_WTWNA: return "Write-through";
+        case WRITE_STRAT_WBWNA: return "Write-back, no write-allocate";
+        case WRITE_STRAT_WTWA: return "Write-through, write-allocate";
+        default: return "Unknown strategy";
+    }
+}
+
+static const char *prefetcher_name(prefetch_kind_t kind) {
+    switch (kind) {
+        case PREFETCH_PLUS_ONE: return "+1";
+        case PREFETCH_STRIDED: return "Strided";
+        case PREFETCH_STREAM: return "Stream";
+        case PREFETCH_GHB: return "GHB";
+        case PREFETCH_DELTA: return "Delta correlation";
+        case PREFETCH_BEST_OFFSET: return "Best-offset";
+        case PREFETCH_STRIDE_TABLE: return "Stride table";
+        default: return "No";
+    }
+}
+
+// The write strategy is only printed when it isn't the usual one of the level
+static void print_cache_config(cache_config_t *cache_config, const char *cache_name, write_strat_t usual_write_strat) {
     printf("%s ", cache_name);
     if (cache_config->disabled) {
         printf("disabled\n");
@@ -222,20 +1250,64 @@ static void print_cache_config(cache_config_t *cache_config, const char *cache_n
             printf(" Prefetcher disabled.");
         } else {
             //printf(" Prefetch enabled.");
-            if (cache_config->strided_prefetch_disabled) {
-                printf(" +1 prefetcher.");
-            } else {
-                printf(" Strided prefetcher.");
+            printf(" %s prefetcher.", prefetcher_name(prefetchKindOf(cache_config)));
+            if (cache_config->prefetch_degree != 1 || cache_config->prefetch_distance != 1) {
+                printf(" Degree %" PRIu64 ", distance %" PRIu64 ".", cache_config->prefetch_degree,
+                       cache_config->prefetch_distance);
             }
             printf(" Prefetch insertion policy: %s.",
             insert_policy_str(cache_config->prefetch_insert_policy)
             );
         }
+        if (cache_config->write_strat != usual_write_strat) {
+            printf(" %s.", write_strat_str(cache_config->write_strat));
+        }
+        if (cache_config->inclusion != INCLUSION_NINE) {
+            printf(" %s.", inclusion_policy_str(cache_config->inclusion));
+        }
+        printf("\n");
+    }
+}
+
+static void print_hierarchy_config(sim_config_t *config) {
+    print_cache_config(&config->l1_config, "L1", WRITE_STRAT_WBWA);
+    if (!config->l1i_config.disabled) {
+        print_cache_config(&config->l1i_config, "L1I", WRITE_STRAT_WBWA);
+    }
+    if (config->victim_entries) {
+        printf("Victim cache: %" PRIu64 " entries\n", config->victim_entries);
+    }
+    print_cache_config(&config->l2_config, "L2", WRITE_STRAT_WTWNA);
+    for (uint64_t i = 0; i < config->num_outer_levels; i++) {
+        char name[8];
+        snprintf(name, sizeof name, "L%" PRIu64, i + 3);
+        print_cache_config(&config->outer_configs[i], name, WRITE_STRAT_WBWA);
+    }
+    if (config->write_buffer_depth) {
+        printf("Write buffer: %" PRIu64 " entries\n", config->write_buffer_depth);
+    }
+}
+
+// Everything a sweep reports about one finished simulation
+static void print_run(sim_config_t *config, const Simulator *sim) {
+    printf("Cache Settings\n");
+    printf("--------------\n");
+    print_hierarchy_config(config);
+    printf("\n");
+    print_statistics(sim->get_stats(), !config->l1i_config.disabled);
+    print_level_statistics(sim);
+    if (sim->get_sample_stats()) {
+        printf("\n");
+        print_sample_statistics(sim->get_sample_stats());
+    }
+    if (sim->get_window_stats()) {
         printf("\n");
+        print_window_statistics(sim->get_window_stats());
     }
 }
 
-static void print_statistics(sim_stats_t* stats) {
+// split_l1: also print the L1I; the L1 lines are then the data L1
+static void print_statistics(const sim_stats_t* stats, bool split_l1) {
     printf("Cache Statistics\n");
     printf("----------------\n");
     printf("Reads: %" PRIu64 "\n", stats->reads);
@@ -248,6 +1320,15 @@ static void print_statistics(sim_stats_t* stats) {
     printf("L1 miss ratio: %.3f\n", stats->miss_ratio_l1);
     printf("L1 average access time (AAT): %.3f\n", stats->avg_access_time_l1);
     printf("\n");
+    if (split_l1) {
+        printf("L1I accesses: %" PRIu64 "\n", stats->accesses_l1i);
+        printf("L1I hits: %" PRIu64 "\n", stats->hits_l1i);
+        printf("L1I misses: %" PRIu64 "\n", stats->misses_l1i);
+        printf("L1I hit ratio: %.3f\n", stats->hit_ratio_l1i);
+        printf("L1I miss ratio: %.3f\n", stats->miss_ratio_l1i);
+        printf("L1I average access time (AAT): %.3f\n", stats->avg_access_time_l1i);
+        printf("\n");
+    }
     printf("L2 reads: %" PRIu64 "\n", stats->reads_l2);
     printf("L2 writes: %" PRIu64 "\n", stats->writes_l2);
     printf("L2 read hits: %" PRIu64 "\n", stats->read_hits_l2);
@@ -257,3 +1338,223 @@ static void print_statistics(sim_stats_t* stats) {
     printf("L2 read miss ratio: %.3f\n", stats->read_miss_ratio_l2);
     printf("L2 average access time (AAT): %.3f\n", stats->avg_access_time_l2);
 }
+
+static void print_level_statistics(const Simulator *sim) {
+    const sim_config_t *config = sim->get_config();
+    bool inclusive = !config->l2_config.disabled && config->l2_config.inclusion == INCLUSION_INCLUSIVE;
+    for (uint64_t i = 0; i < config->num_outer_levels; i++) {
+        inclusive |= config->outer_configs[i].inclusion == INCLUSION_INCLUSIVE;
+    }
+    if (inclusive) {
+        printf("Back-invalidations: %" PRIu64 "\n", sim->get_stats()->back_invalidations);
+    }
+    if (config->victim_entries) {
+        const sim_stats_t *stats = sim->get_stats();
+        printf("\n");
+        printf("Victim cache hits: %" PRIu64 "\n", stats->hits_vc);
+        printf("Victim cache misses: %" PRIu64 "\n", stats->misses_vc);
+        printf("Victim cache hit ratio: %.3f\n", stats->hit_ratio_vc);
+    }
+
+    const sim_level_stats_t *stats;
+    for (uint64_t level = 3; (stats = sim->get_level_stats(level)); level++) {
+        printf("\n");
+        printf("L%" PRIu64 " reads: %" PRIu64 "\n", level, stats->reads);
+        printf("L%" PRIu64 " writes: %" PRIu64 "\n", level, stats->writes);
+        printf("L%" PRIu64 " read hits: %" PRIu64 "\n", level, stats->read_hits);
+        printf("L%" PRIu64 " read misses: %" PRIu64 "\n", level, stats->read_misses);
+        printf("L%" PRIu64 " prefetches: %" PRIu64 "\n", level, stats->prefetches);
+        printf("L%" PRIu64 " read hit ratio: %.3f\n", level, stats->read_hit_ratio);
+        printf("L%" PRIu64 " read miss ratio: %.3f\n", level, stats->read_miss_ratio);
+        printf("L%" PRIu64 " average access time (AAT): %.3f\n", level, stats->avg_access_time);
+    }
+
+    if (config->prefetch_stats) {
+        for (uint64_t level = 2; level <= config->num_outer_levels + 2; level++) {
+            const cache_config_t *cache_config = level == 2 ? &config->l2_config : &config->outer_configs[level - 3];
+            if (cache_config->disabled || prefetchKindOf(cache_config) == PREFETCH_NONE) {
+                continue;
+            }
+            const sim_stats_t *l2 = sim->get_stats();
+            const sim_level_stats_t *outer = sim->get_level_stats(level);
+            uint64_t useful = outer ? outer->useful_prefetches : l2->useful_prefetches_l2;
+            uint64_t polluting = outer ? outer->polluting_misses : l2->polluting_misses_l2;
+            uint64_t read_misses = outer ? outer->read_misses : l2->read_misses_l2;
+            printf("\n");
+            printf("L%" PRIu64 " useful prefetches: %" PRIu64 "\n", level, useful);
+            printf("L%" PRIu64 " prefetch accuracy: %.3f\n", level,
+                   outer ? outer->prefetch_accuracy : l2->prefetch_accuracy_l2);
+            printf("L%" PRIu64 " prefetch coverage: %.3f\n", level,
+                   outer ? outer->prefetch_coverage : l2->prefetch_coverage_l2);
+            printf("L%" PRIu64 " polluting misses: %" PRIu64 "\n", level, polluting);
+            printf("L%" PRIu64 " prefetch pollution: %.3f\n", level,
+                   read_misses ? static_cast<double>(polluting) / read_misses : 0);
+        }
+    }
+
+    // In the default hierarchy every L2 write goes on to DRAM, so DRAM
+    // writes are only worth a line when that isn't so
+    bool usual_writes = config->num_outer_levels == 0 && config->write_buffer_depth == 0 &&
+                        config->l1_config.write_strat == WRITE_STRAT_WBWA &&
+                        (config->l2_config.disabled || config->l2_config.write_strat == WRITE_STRAT_WTWNA);
+    if (!usual_writes) {
+        printf("\n");
+        printf("DRAM writes: %" PRIu64 "\n", sim->get_stats()->writes_dram);
+        if (config->write_buffer_depth) {
+            printf("Write buffer merges: %" PRIu64 "\n", sim->get_stats()->write_buffer_merges);
+        }
+    }
+}
+
+static void print_sample_statistics(const sim_sample_stats_t *sample) {
+    printf("Set Sampling (95%% confidence)\n");
+    printf("-----------------------------\n");
+    printf("Sampled set groups: %" PRIu64 " of %" PRIu64 "\n", sample->sampled_groups, sample->groups);
+    printf("Sampled accesses: %" PRIu64 " of %" PRIu64 "\n", sample->sampled_accesses, sample->accesses);
+    printf("L1 miss ratio error: +/- %.3f\n", sample->miss_ratio_l1_err);
+    printf("L2 read miss ratio error: +/- %.3f\n", sample->read_miss_ratio_l2_err);
+    printf("L1 average access time (AAT) error: +/- %.3f\n", sample->avg_access_time_l1_err);
+}
+
+static void print_window_statistics(const sim_window_stats_t *windows) {
+    printf("Time Sampling\n");
+    printf("-------------\n");
+    printf("Measured windows: %" PRIu64 "\n", windows->windows);
+    printf("Measured accesses: %" PRIu64 " of %" PRIu64 "\n", windows->measured_accesses, windows->accesses);
+    printf("L1 hit ratio per window: mean %.3f, variance %.6f\n",
+           windows->hit_ratio_l1_mean, windows->hit_ratio_l1_var);
+    printf("L2 read hit ratio per window: mean %.3f, variance %.6f\n",
+           windows->read_hit_ratio_l2_mean, windows->read_hit_ratio_l2_var);
+    printf("L1 average access time (AAT) per window: mean %.3f, variance %.6f\n",
+           windows->avg_access_time_l1_mean, windows->avg_access_time_l1_var);
+}
+
+static const char *prefetcher_str(const cache_config_t *cache_config) {
+    if (cache_config->disabled) {
+        return "-";
+    }
+    switch (prefetchKindOf(cache_config)) {
+        case PREFETCH_PLUS_ONE: return "+1";
+        case PREFETCH_STRIDED: return "stride";
+        case PREFETCH_STREAM: return "stream";
+        case PREFETCH_GHB: return "ghb";
+        case PREFETCH_DELTA: return "delta";
+        case PREFETCH_BEST_OFFSET: return "bo";
+        case PREFETCH_STRIDE_TABLE: return "table";
+        default: return "none";
+    }
+}
+
+// The option values accepted for a write strategy and an inclusion policy
+static const char *write_strat_arg(write_strat_t strat) {
+    switch (strat) {
+        case WRITE_STRAT_WTWNA: return "wtwna";
+        case WRITE_STRAT_WBWNA: return "wbwna";
+        case WRITE_STRAT_WTWA: return "wtwa";
+        default: return "wbwa";
+    }
+}
+
+static const char *inclusion_policy_arg(inclusion_policy_t policy) {
+    switch (policy) {
+        case INCLUSION_INCLUSIVE: return "inc";
+        case INCLUSION_EXCLUSIVE: return "exc";
+        default: return "nine";
+    }
+}
+
+// Append the level spec of a cache as --level takes it: its size, then
+// only the settings that differ from a fresh level's
+static void append_level_spec(std::string *label, const cache_config_t *cache_config,
+                              write_strat_t usual_write_strat) {
+    char item[64];
+    snprintf(item, sizeof item, "c=%" PRIu64 ",s=%" PRIu64, cache_config->c, cache_config->s);
+    *label += item;
+    if (!cache_config->prefetcher_disabled) {
+        snprintf(item, sizeof item, ",p=%d,g=%" PRIu64 ",a=%" PRIu64 ",i=%s", (int)prefetchKindOf(cache_config),
+                 cache_config->prefetch_degree, cache_config->prefetch_distance,
+                 cache_config->prefetch_insert_policy == INSERT_POLICY_LIP ? "lip" : "mip");
+        *label += item;
+    }
+    if (cache_config->write_strat != usual_write_strat) {
+        *label += std::string(",w=") + write_strat_arg(cache_config->write_strat);
+    }
+    if (cache_config->inclusion != INCLUSION_NINE) {
+        *label += std::string(",x=") + inclusion_policy_arg(cache_config->inclusion);
+    }
+}
+
+// The settings of config that the other sweep table columns don't show,
+// written as options, e.g. "-G 2 -X inc -V 8 --level c=20,s=4", or "-"
+static std::string config_label(const sim_config_t *config) {
+    const cache_config_t *l2 = &config->l2_config;
+    std::string label;
+    char item[64];
+    if (!l2->disabled && !l2->prefetcher_disabled && l2->prefetch_degree != 1) {
+        snprintf(item, sizeof item, " -G %" PRIu64, l2->prefetch_degree);
+        label += item;
+    }
+    if (!l2->disabled && !l2->prefetcher_disabled && l2->prefetch_distance != 1) {
+        snprintf(item, sizeof item, " -A %" PRIu64, l2->prefetch_distance);
+        label += item;
+    }
+    if (!l2->disabled && l2->inclusion != INCLUSION_NINE) {
+        label += std::string(" -X ") + inclusion_policy_arg(l2->inclusion);
+    }
+    if (config->victim_entries) {
+        snprintf(item, sizeof item, " -V %" PRIu64, config->victim_entries);
+        label += item;
+    }
+    if (config->l1_config.write_strat != WRITE_STRAT_WBWA) {
+        label += std::string(" -w ") + write_strat_arg(config->l1_config.write_strat);
+    }
+    if (!l2->disabled && l2->write_strat != WRITE_STRAT_WTWNA) {
+        label += std::string(" -W ") + write_strat_arg(l2->write_strat);
+    }
+    if (config->write_buffer_depth) {
+        snprintf(item, sizeof item, " -M %" PRIu64, config->write_buffer_depth);
+        label += item;
+    }
+    if (!config->l1i_config.disabled) {
+        label += " --l1i ";
+        append_level_spec(&label, &config->l1i_config, WRITE_STRAT_WBWA);
+    }
+    for (uint64_t i = 0; i < config->num_outer_levels; i++) {
+        label += " --level ";
+        append_level_spec(&label, &config->outer_configs[i], WRITE_STRAT_WBWA);
+    }
+    return label.empty() ? "-" : label.substr(1);
+}
+
+// One row per (trace, configuration) job, in trace-major order
+static void print_sweep_table(const std::vector<sim_config_t> &configs, const std::vector<trace_buffer_t> &traces,
+                              const std::vector<sim_stats_t> &results) {
+    printf("%-32s %-10s %-10s %-4s %-6s %-4s %10s %10s %8s %8s %10s %10s %10s %8s %8s  %s\n",
+           "Trace", "L1 (CBS)", "L2 (CBS)", "Repl", "Pref", "Ins",
+           "Accesses", "L1 misses", "L1 HR", "L1 AAT",
+           "L2 reads", "L2 writes", "L2 prefs", "L2 HR", "L2 AAT", "Other settings");
+    for (size_t t = 0; t < traces.size(); t++) {
+        for (size_t c = 0; c < configs.size(); c++) {
+            const sim_config_t *config = &configs[c];
+            const sim_stats_t *stats = &results[t * configs.size() + c];
+            char l1[32];
+            char l2[32];
+            snprintf(l1, sizeof l1, "%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+                     config->l1_config.c, config->l1_config.b, config->l1_config.s);
+            if (config->l2_config.disabled) {
+                snprintf(l2, sizeof l2, "disabled");
+            } else {
+                snprintf(l2, sizeof l2, "%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+                         config->l2_config.c, config->l2_config.b, config->l2_config.s);
+            }
+            printf("%-32s %-10s %-10s %-4s %-6s %-4s %10" PRIu64 " %10" PRIu64 " %8.3f %8.3f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %8.3f %8.3f  %s\n",
+                   traces[t].name.c_str(), l1, l2,
+                   replace_policy_str(config->l2_config.replace_policy),
+                   prefetcher_str(&config->l2_config),
+                   config->l2_config.disabled ? "-" : insert_policy_str(config->l2_config.prefetch_insert_policy),
+                   stats->accesses_l1, stats->misses_l1, stats->hit_ratio_l1, stats->avg_access_time_l1,
+                   stats->reads_l2, stats->writes_l2, stats->prefetches_l2,
+                   stats->read_hit_ratio_l2, stats->avg_access_time_l2, config_label(config).c_str());
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cachesim_pool.hpp"
+
+// Pending jobs of one worker
+typedef struct work_queue
+{
+    std::mutex lock;
+    std::deque<size_t> jobs;
+} work_queue_t;
+
+// Take a job from the back of our own queue
+static bool pop_own(work_queue_t *queue, size_t *job_out)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->jobs.empty())
+    {
+        return false;
+    }
+    *job_out = queue->jobs.back();
+    queue->jobs.pop_back();
+    return true;
+}
+
+// Take a job from the front of another worker's queue
+static bool steal(work_queue_t *queue, size_t *job_out)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    if (queue->jobs.empty())
+    {
+        return false;
+    }
+    *job_out = queue->jobs.front();
+    queue->jobs.pop_front();
+    return true;
+}
+
+static void worker(std::vector<work_queue_t> *queues, unsigned id, const std::function<void(size_t)> *job)
+{
+    unsigned num_queues = queues->size();
+    size_t next;
+
+    for (;;)
+    {
+        if (pop_own(&(*queues)[id], &next))
+        {
+            (*job)(next);
+            continue;
+        }
+
+        // No job is ever queued after start-up, so once every queue is
+        // empty there is nothing left to do
+        bool stole = false;
+        for (unsigned i = 1; i < num_queues && !stole; i++)
+        {
+            stole = steal(&(*queues)[(id + i) % num_queues], &next);
+        }
+        if (!stole)
+        {
+            return;
+        }
+        (*job)(next);
+    }
+}
+
+void run_work_stealing(size_t num_jobs, unsigned num_threads, const std::function<void(size_t)> &job)
+{
+    if (num_threads == 0)
+    {
+        num_threads = 1;
+    }
+    if (num_threads > num_jobs)
+    {
+        num_threads = num_jobs ? num_jobs : 1;
+    }
+
+    std::vector<work_queue_t> queues(num_threads);
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        queues[i % num_threads].jobs.push_back(i);
+    }
+
+    // The calling thread works as worker 0
+    std::vector<std::thread> threads;
+    for (unsigned id = 1; id < num_threads; id++)
+    {
+        threads.push_back(std::thread(worker, &queues, id, &job));
+    }
+    worker(&queues, 0, &job);
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
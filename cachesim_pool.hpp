@@ -0,0 +1,14 @@
+#ifndef CACHESIM_POOL_HPP
+#define CACHESIM_POOL_HPP
+
+#include <stddef.h>
+#include <functional>
+
+// Run job(0) .. job(num_jobs - 1) on num_threads worker threads. The jobs
+// are dealt round-robin into one deque per worker; a worker takes work from
+// the back of its own deque and steals from the front of the others once it
+// runs dry, so uneven job lengths still keep every core busy. Returns when
+// all jobs have finished.
+void run_work_stealing(size_t num_jobs, unsigned num_threads, const std::function<void(size_t)> &job);
+
+#endif /* CACHESIM_POOL_HPP */
@@ -0,0 +1,323 @@
+#include <string.h>
+#include "cachesim_prefetch.hpp"
+
+// A miss this close (in blocks) to a stream's last one continues it
+static const int64_t STREAM_WINDOW = 16;
+// Misses in one direction before a stream is prefetched
+static const uint64_t STREAM_CONFIRM = 2;
+static const uint64_t STREAM_CONFIDENCE_MAX = 8;
+
+// Best-offset tuning from Michaud (HPCA 2016): a learning phase ends after
+// BO_ROUNDS passes over the offsets or once one scores BO_SCORE_MAX, and an
+// offset that scored at most BO_BAD_SCORE turns prefetching off
+static const uint64_t BO_ROUNDS = 100;
+static const uint64_t BO_SCORE_MAX = 31;
+static const uint64_t BO_BAD_SCORE = 1;
+static const int64_t BO_OFFSETS[PREFETCH_BO_OFFSETS] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                                                        14, 15, 16, 18, 20, 24, 30, 32, 36, 40, 48, 50, 64};
+
+// A region's stride is trusted once it repeated this often in a row
+static const uint64_t STRIDE_CONFIRM = 2;
+static const uint64_t STRIDE_CONFIDENCE_MAX = 3;
+
+static const uint64_t HASH_MUL = 0x9E3779B97F4A7C15ULL;
+
+void initPrefetcher(prefetcher_t *pf)
+{
+    memset(pf, 0, sizeof *pf);
+    pf->bo_offset = 1;
+}
+
+static inline uint64_t hashBlock(uint64_t block, uint64_t entries)
+{
+    return ((block * HASH_MUL) >> 32) % entries;
+}
+
+// Blocks base + step * (distance + i) for i < degree
+static uint64_t stepCandidates(uint64_t base, int64_t step, uint64_t degree, uint64_t distance, uint64_t *candidates)
+{
+    for (uint64_t i = 0; i < degree; i++)
+    {
+        candidates[i] = base + step * (int64_t)(distance + i);
+    }
+    return degree;
+}
+
+// Follow the stream the miss continues, or start a new one in place of the
+// least recently used
+static uint64_t streamCandidates(prefetcher_t *pf, uint64_t degree, uint64_t distance, uint64_t block,
+                                 uint64_t *candidates)
+{
+    pf->stream_clock++;
+    prefetch_stream_t *oldest = &pf->streams[0];
+    for (uint64_t i = 0; i < PREFETCH_STREAMS; i++)
+    {
+        prefetch_stream_t *stream = &pf->streams[i];
+        int64_t delta = (int64_t)(block - stream->last_block);
+        // Missing the stream's last block again (after an eviction, say)
+        // keeps the stream alive without moving it
+        if (stream->last_use && delta == 0)
+        {
+            stream->last_use = pf->stream_clock;
+            return 0;
+        }
+        if (stream->last_use && delta >= -STREAM_WINDOW && delta <= STREAM_WINDOW)
+        {
+            int64_t direction = delta > 0 ? 1 : -1;
+            if (direction == stream->direction)
+            {
+                stream->confidence += stream->confidence < STREAM_CONFIDENCE_MAX;
+            }
+            else
+            {
+                stream->direction = direction;
+                stream->confidence = 1;
+            }
+            stream->last_block = block;
+            stream->last_use = pf->stream_clock;
+            if (stream->confidence < STREAM_CONFIRM)
+            {
+                return 0;
+            }
+            return stepCandidates(block, direction, degree, distance, candidates);
+        }
+        if (stream->last_use < oldest->last_use)
+        {
+            oldest = stream;
+        }
+    }
+
+    oldest->last_block = block;
+    oldest->direction = 0;
+    oldest->confidence = 0;
+    oldest->last_use = pf->stream_clock;
+    return 0;
+}
+
+// Record the miss, then replay the misses that followed the previous miss
+// to the same block, and if those run out before degree, the ones after
+// the miss to it before that, while they are still in the buffer
+static uint64_t ghbCandidates(prefetcher_t *pf, uint64_t degree, uint64_t distance, uint64_t block,
+                              uint64_t *candidates)
+{
+    uint64_t *head = &pf->ghb_index[hashBlock(block, PREFETCH_GHB_INDEX)];
+    uint64_t now = ++pf->ghb_next;
+    pf->ghb_blocks[now % PREFETCH_GHB_ENTRIES] = block;
+    pf->ghb_links[now % PREFETCH_GHB_ENTRIES] = *head;
+    *head = now;
+
+    uint64_t n = 0;
+    uint64_t seen = pf->ghb_links[now % PREFETCH_GHB_ENTRIES];
+    // An entry may have been overwritten, or the hash shared
+    while (n < degree && seen != 0 && now - seen < PREFETCH_GHB_ENTRIES &&
+           pf->ghb_blocks[seen % PREFETCH_GHB_ENTRIES] == block)
+    {
+        for (uint64_t next = seen + distance; n < degree && next < now; next++)
+        {
+            candidates[n++] = pf->ghb_blocks[next % PREFETCH_GHB_ENTRIES];
+        }
+        seen = pf->ghb_links[seen % PREFETCH_GHB_ENTRIES];
+    }
+    return n;
+}
+
+static inline int64_t deltaAt(const prefetcher_t *pf, uint64_t i)
+{
+    return pf->deltas[i % PREFETCH_DELTAS];
+}
+
+// Find the latest earlier occurrence of the last pair of deltas in the
+// history and apply the deltas that came after it, over and over, from
+// block on
+static uint64_t deltaCandidates(prefetcher_t *pf, uint64_t degree, uint64_t distance, uint64_t block,
+                                uint64_t *candidates)
+{
+    if (pf->delta_misses++)
+    {
+        pf->deltas[(pf->delta_misses - 2) % PREFETCH_DELTAS] = (int64_t)(block - pf->delta_last_block);
+    }
+    pf->delta_last_block = block;
+
+    uint64_t count = pf->delta_misses ? pf->delta_misses - 1 : 0;
+    if (count < 3)
+    {
+        return 0;
+    }
+    uint64_t oldest = count > PREFETCH_DELTAS ? count - PREFETCH_DELTAS : 0;
+    int64_t d1 = deltaAt(pf, count - 2);
+    int64_t d2 = deltaAt(pf, count - 1);
+    for (uint64_t j = count - 2; j >= oldest + 1; j--)
+    {
+        if (deltaAt(pf, j - 1) != d1 || deltaAt(pf, j) != d2)
+        {
+            continue;
+        }
+        uint64_t period = count - 1 - j;
+        uint64_t n = 0;
+        uint64_t target = block;
+        for (uint64_t step = 1; n < degree; step++)
+        {
+            target += deltaAt(pf, j + 1 + (step - 1) % period);
+            if (step >= distance)
+            {
+                candidates[n++] = target;
+            }
+        }
+        return n;
+    }
+    return 0;
+}
+
+// Score one offset per miss: it would have covered this miss if the block
+// that far back missed recently. At the end of a phase the best offset
+// becomes the one in use.
+static uint64_t bestOffsetCandidates(prefetcher_t *pf, uint64_t degree, uint64_t distance, uint64_t block,
+                                     uint64_t *candidates)
+{
+    uint64_t tested = block - BO_OFFSETS[pf->bo_test];
+    if (pf->bo_recent[hashBlock(tested, PREFETCH_BO_RECENT)] == tested)
+    {
+        pf->bo_scores[pf->bo_test]++;
+    }
+    bool done = pf->bo_scores[pf->bo_test] >= BO_SCORE_MAX;
+    if (++pf->bo_test == PREFETCH_BO_OFFSETS)
+    {
+        pf->bo_test = 0;
+        done |= ++pf->bo_rounds >= BO_ROUNDS;
+    }
+    if (done)
+    {
+        uint64_t best = 0;
+        for (uint64_t i = 1; i < PREFETCH_BO_OFFSETS; i++)
+        {
+            best = pf->bo_scores[i] > pf->bo_scores[best] ? i : best;
+        }
+        pf->bo_offset = pf->bo_scores[best] > BO_BAD_SCORE ? BO_OFFSETS[best] : 0;
+        memset(pf->bo_scores, 0, sizeof pf->bo_scores);
+        pf->bo_test = 0;
+        pf->bo_rounds = 0;
+    }
+    pf->bo_recent[hashBlock(block, PREFETCH_BO_RECENT)] = block;
+
+    if (pf->bo_offset == 0)
+    {
+        return 0;
+    }
+    return stepCandidates(block, pf->bo_offset, degree, distance, candidates);
+}
+
+// Look the miss's region up in the stride table. A stride that repeats
+// builds confidence and one that doesn't wears it down, and only replaces
+// the stride once none is left. New regions take the LRU entry.
+static uint64_t strideTableCandidates(prefetcher_t *pf, uint64_t degree, uint64_t distance, uint64_t block,
+                                      uint64_t region, uint64_t *candidates)
+{
+    pf->stride_clock++;
+    prefetch_stride_entry_t *oldest = &pf->stride_table[0];
+    for (uint64_t i = 0; i < PREFETCH_STRIDE_ENTRIES; i++)
+    {
+        prefetch_stride_entry_t *entry = &pf->stride_table[i];
+        if (entry->last_use && entry->region == region)
+        {
+            int64_t delta = (int64_t)(block - entry->last_block);
+            entry->last_use = pf->stride_clock;
+            if (delta == 0)
+            {
+                return 0;
+            }
+            entry->last_block = block;
+            if (delta == entry->stride)
+            {
+                entry->confidence += entry->confidence < STRIDE_CONFIDENCE_MAX;
+            }
+            else if (entry->confidence > 0)
+            {
+                entry->confidence--;
+            }
+            else
+            {
+                entry->stride = delta;
+            }
+            if (entry->confidence < STRIDE_CONFIRM)
+            {
+                return 0;
+            }
+            return stepCandidates(block, entry->stride, degree, distance, candidates);
+        }
+        if (entry->last_use < oldest->last_use)
+        {
+            oldest = entry;
+        }
+    }
+
+    oldest->region = region;
+    oldest->last_block = block;
+    oldest->stride = 0;
+    oldest->confidence = 0;
+    oldest->last_use = pf->stride_clock;
+    return 0;
+}
+
+uint64_t prefetchCandidates(prefetcher_t *pf, prefetch_kind_t kind, uint64_t degree, uint64_t distance,
+                            uint64_t b, uint64_t block_addr, uint64_t *candidates)
+{
+    uint64_t block = block_addr >> b;
+    uint64_t n = 0;
+    switch (kind)
+    {
+    case PREFETCH_PLUS_ONE:
+        n = stepCandidates(block, 1, degree, distance, candidates);
+        break;
+    case PREFETCH_STRIDED:
+        n = stepCandidates(block, (int64_t)(block - (pf->prev_block_addr >> b)), degree, distance, candidates);
+        pf->prev_block_addr = block_addr;
+        break;
+    case PREFETCH_STREAM:
+        n = streamCandidates(pf, degree, distance, block, candidates);
+        break;
+    case PREFETCH_GHB:
+        n = ghbCandidates(pf, degree, distance, block, candidates);
+        break;
+    case PREFETCH_DELTA:
+        n = deltaCandidates(pf, degree, distance, block, candidates);
+        break;
+    case PREFETCH_BEST_OFFSET:
+        n = bestOffsetCandidates(pf, degree, distance, block, candidates);
+        break;
+    case PREFETCH_STRIDE_TABLE:
+        n = strideTableCandidates(pf, degree, distance, block, block_addr >> PREFETCH_REGION_BITS, candidates);
+        break;
+    default:
+        break;
+    }
+    for (uint64_t i = 0; i < n; i++)
+    {
+        candidates[i] <<= b;
+    }
+    return n;
+}
+
+// Trained on misses alone, a stride the table covers would show up as a
+// multiple of itself and lose its confidence
+bool prefetchTrainsOnHits(prefetch_kind_t kind)
+{
+    return kind == PREFETCH_STRIDE_TABLE;
+}
+
+void notePrefetchVictim(prefetcher_t *pf, uint64_t b, uint64_t block_addr)
+{
+    uint64_t block = block_addr >> b;
+    pf->evicted[hashBlock(block, PREFETCH_EVICTED)] = block + 1;
+}
+
+bool takePrefetchVictim(prefetcher_t *pf, uint64_t b, uint64_t block_addr)
+{
+    uint64_t block = block_addr >> b;
+    uint64_t *slot = &pf->evicted[hashBlock(block, PREFETCH_EVICTED)];
+    if (*slot != block + 1)
+    {
+        return false;
+    }
+    *slot = 0;
+    return true;
+}
@@ -0,0 +1,124 @@
+#ifndef CACHESIM_PREFETCH_HPP
+#define CACHESIM_PREFETCH_HPP
+
+#include <stdint.h>
+
+typedef enum prefetch_kind
+{
+    PREFETCH_NONE,
+    // Next block
+    PREFETCH_PLUS_ONE,
+    // Next block at the stride between the last two misses
+    PREFETCH_STRIDED,
+    // Ahead of each of several concurrent sequential streams
+    PREFETCH_STREAM,
+    // Global history buffer, address correlation: the misses that followed
+    // the previous miss to the same block
+    PREFETCH_GHB,
+    // The deltas that followed the last time the latest pair of deltas
+    // between misses was seen
+    PREFETCH_DELTA,
+    // A single offset, learned by scoring candidate offsets against
+    // recent misses
+    PREFETCH_BEST_OFFSET,
+    // Stride per memory region: a table keyed by region learns each
+    // region's stride and prefetches once it has repeated, so interleaved
+    // streams don't disturb each other
+    PREFETCH_STRIDE_TABLE,
+} prefetch_kind_t;
+
+// Most blocks one miss may prefetch, and the furthest ahead they may start
+static const uint64_t PREFETCH_MAX_DEGREE = 16;
+static const uint64_t PREFETCH_MAX_DISTANCE = 64;
+
+static const uint64_t PREFETCH_STREAMS = 16;
+static const uint64_t PREFETCH_GHB_ENTRIES = 256;
+static const uint64_t PREFETCH_GHB_INDEX = 256;
+static const uint64_t PREFETCH_DELTAS = 32;
+static const uint64_t PREFETCH_BO_OFFSETS = 26;
+static const uint64_t PREFETCH_BO_RECENT = 256;
+static const uint64_t PREFETCH_STRIDE_ENTRIES = 32;
+// Regions of the stride table are 2^PREFETCH_REGION_BITS bytes (pages)
+static const uint64_t PREFETCH_REGION_BITS = 12;
+static const uint64_t PREFETCH_EVICTED = 1024;
+
+typedef struct prefetch_stream
+{
+    uint64_t last_block;
+    int64_t direction;
+    uint64_t confidence;
+    uint64_t last_use;
+} prefetch_stream_t;
+
+typedef struct prefetch_stride_entry
+{
+    uint64_t region;
+    uint64_t last_block;
+    int64_t stride;
+    uint64_t confidence;
+    uint64_t last_use;
+} prefetch_stride_entry_t;
+
+// Training state of one level's prefetcher. Every prefetcher keeps its own
+// part, so switching a level to another prefetcher starts that one cold.
+// Plain data, copied and checkpointed as it is. Addresses here are block
+// numbers (address >> B) except prev_block_addr.
+typedef struct prefetcher
+{
+    // Strided: block address of the previous miss
+    uint64_t prev_block_addr;
+
+    prefetch_stream_t streams[PREFETCH_STREAMS];
+    uint64_t stream_clock;
+
+    // Ring of the last misses, numbered from 1 by ghb_next. Each entry links
+    // to the number of the previous miss to the same block (0 if none),
+    // found through a hash of the block in ghb_index.
+    uint64_t ghb_blocks[PREFETCH_GHB_ENTRIES];
+    uint64_t ghb_links[PREFETCH_GHB_ENTRIES];
+    uint64_t ghb_index[PREFETCH_GHB_INDEX];
+    uint64_t ghb_next;
+
+    // Ring of the deltas between the last misses, one fewer than
+    // delta_misses in all
+    int64_t deltas[PREFETCH_DELTAS];
+    uint64_t delta_misses;
+    uint64_t delta_last_block;
+
+    // Best-offset learning: recent miss blocks by hash, the score of each
+    // offset in this round, the offset tested next and the one in use
+    uint64_t bo_recent[PREFETCH_BO_RECENT];
+    uint64_t bo_scores[PREFETCH_BO_OFFSETS];
+    uint64_t bo_test;
+    uint64_t bo_rounds;
+    int64_t bo_offset;
+
+    // Fully associative, LRU replaced
+    prefetch_stride_entry_t stride_table[PREFETCH_STRIDE_ENTRIES];
+    uint64_t stride_clock;
+
+    // Not training state: blocks this level's prefetches evicted, by hash
+    // (block + 1, 0 = empty), to tell which later misses they caused
+    uint64_t evicted[PREFETCH_EVICTED];
+} prefetcher_t;
+
+void initPrefetcher(prefetcher_t *pf);
+
+// Train pf on a demand miss to the block at block_addr, in a cache with
+// 2^b byte blocks, and write the addresses of the blocks to prefetch to
+// candidates (room for PREFETCH_MAX_DEGREE), returning how many. degree
+// caps their number and distance is how many blocks (or strides, or
+// deltas) ahead the first one is.
+uint64_t prefetchCandidates(prefetcher_t *pf, prefetch_kind_t kind, uint64_t degree, uint64_t distance,
+                            uint64_t b, uint64_t block_addr, uint64_t *candidates);
+
+// Whether kind also trains on the first demand hit to a block it
+// prefetched, not just on misses
+bool prefetchTrainsOnHits(prefetch_kind_t kind);
+
+// Remember that a prefetch evicted the block at block_addr, and later find
+// out (once) whether a miss to block_addr is one of those
+void notePrefetchVictim(prefetcher_t *pf, uint64_t b, uint64_t block_addr);
+bool takePrefetchVictim(prefetcher_t *pf, uint64_t b, uint64_t block_addr);
+
+#endif /* CACHESIM_PREFETCH_HPP */
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cachesim_simd.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CACHESIM_X86 1
+#include <immintrin.h>
+#endif
+
+uint64_t matchTagsScalar(const uint64_t *tags, uint64_t num_ways, uint64_t tag)
+{
+    uint64_t mask = 0;
+    for (uint64_t i = 0; i < num_ways; i++)
+    {
+        mask |= (uint64_t)(tags[i] == tag) << i;
+    }
+    return mask;
+}
+
+#ifdef CACHESIM_X86
+// Two ways per compare
+__attribute__((target("sse4.1")))
+uint64_t matchTagsSSE4(const uint64_t *tags, uint64_t num_ways, uint64_t tag)
+{
+    __m128i key = _mm_set1_epi64x(tag);
+    uint64_t mask = 0;
+    uint64_t i = 0;
+    for (; i + 2 <= num_ways; i += 2)
+    {
+        __m128i ways = _mm_loadu_si128((const __m128i *)(tags + i));
+        uint64_t hits = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(ways, key)));
+        mask |= hits << i;
+    }
+    for (; i < num_ways; i++)
+    {
+        mask |= (uint64_t)(tags[i] == tag) << i;
+    }
+    return mask;
+}
+
+// Four ways per compare
+__attribute__((target("avx2")))
+uint64_t matchTagsAVX2(const uint64_t *tags, uint64_t num_ways, uint64_t tag)
+{
+    __m256i key = _mm256_set1_epi64x(tag);
+    uint64_t mask = 0;
+    uint64_t i = 0;
+    for (; i + 4 <= num_ways; i += 4)
+    {
+        __m256i ways = _mm256_loadu_si256((const __m256i *)(tags + i));
+        uint64_t hits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(ways, key)));
+        mask |= hits << i;
+    }
+    for (; i < num_ways; i++)
+    {
+        mask |= (uint64_t)(tags[i] == tag) << i;
+    }
+    return mask;
+}
+
+bool cpuHasSSE4(void)
+{
+    return __builtin_cpu_supports("sse4.1");
+}
+
+bool cpuHasAVX2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+#else
+uint64_t matchTagsSSE4(const uint64_t *tags, uint64_t num_ways, uint64_t tag)
+{
+    return matchTagsScalar(tags, num_ways, tag);
+}
+
+uint64_t matchTagsAVX2(const uint64_t *tags, uint64_t num_ways, uint64_t tag)
+{
+    return matchTagsScalar(tags, num_ways, tag);
+}
+
+bool cpuHasSSE4(void)
+{
+    return false;
+}
+
+bool cpuHasAVX2(void)
+{
+    return false;
+}
+#endif
+
+tag_match_fn selectTagMatch(uint64_t num_ways)
+{
+    const char *forced = getenv("CACHESIM_TAG_MATCH");
+    if (forced && *forced)
+    {
+        if (!strcmp(forced, "avx2") && cpuHasAVX2())
+        {
+            return matchTagsAVX2;
+        }
+        if (!strcmp(forced, "sse4") && cpuHasSSE4())
+        {
+            return matchTagsSSE4;
+        }
+        return matchTagsScalar;
+    }
+
+    // Narrow sets don't fill a vector; the plain loop wins up to 2 ways
+    if (num_ways >= 4 && cpuHasAVX2())
+    {
+        return matchTagsAVX2;
+    }
+    if (num_ways >= 4 && cpuHasSSE4())
+    {
+        return matchTagsSSE4;
+    }
+    return matchTagsScalar;
+}
@@ -0,0 +1,22 @@
+#ifndef CACHESIM_SIMD_HPP
+#define CACHESIM_SIMD_HPP
+
+#include <stdint.h>
+
+// Tag-match kernels: return the bitmask of the ways among
+// tags[0 .. num_ways) (at most 64) that hold tag. Bit i stands for way i.
+typedef uint64_t (*tag_match_fn)(const uint64_t *tags, uint64_t num_ways, uint64_t tag);
+
+uint64_t matchTagsScalar(const uint64_t *tags, uint64_t num_ways, uint64_t tag);
+uint64_t matchTagsSSE4(const uint64_t *tags, uint64_t num_ways, uint64_t tag);
+uint64_t matchTagsAVX2(const uint64_t *tags, uint64_t num_ways, uint64_t tag);
+
+bool cpuHasSSE4(void);
+bool cpuHasAVX2(void);
+
+// Pick the fastest kernel the CPU supports for sets of num_ways ways. The
+// CACHESIM_TAG_MATCH environment variable (scalar, sse4 or avx2) overrides
+// the choice.
+tag_match_fn selectTagMatch(uint64_t num_ways);
+
+#endif /* CACHESIM_SIMD_HPP */
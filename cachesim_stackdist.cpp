@@ -0,0 +1,114 @@
+#include <string.h>
+#include "cachesim_stackdist.hpp"
+
+static const uint32_t NO_TIME = UINT32_MAX;
+// Times per set before its first compaction
+static const uint32_t MIN_SET_TIMES = 64;
+
+StackDistance::StackDistance(uint64_t b, uint64_t max_index_bits)
+    : b(b), num_accesses(0), levels(max_index_bits + 1)
+{
+    for (uint64_t k = 0; k <= max_index_bits; k++) {
+        memset(levels[k].bins, 0, sizeof levels[k].bins);
+    }
+}
+
+static void fenwick_add(std::vector<uint32_t> &tree, uint32_t pos, int32_t delta) {
+    for (uint32_t i = pos + 1; i < tree.size(); i += i & -i) {
+        tree[i] += delta;
+    }
+}
+
+// Number of marks at times 0 .. pos
+static uint32_t fenwick_prefix(const std::vector<uint32_t> &tree, uint32_t pos) {
+    uint32_t sum = 0;
+    for (uint32_t i = pos + 1; i > 0; i -= i & -i) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+// Renumber the live blocks of a set that ran out of times to 0 .. live - 1,
+// keeping their order, and size the set for twice as many
+void StackDistance::compact(level *lvl, set_stack *set) {
+    uint32_t capacity = set->live * 2 > MIN_SET_TIMES ? set->live * 2 : MIN_SET_TIMES;
+    std::vector<uint32_t> owner(capacity, NO_TIME);
+    uint32_t next = 0;
+
+    for (uint32_t t = 0; t < set->now; t++) {
+        if (set->owner[t] != NO_TIME) {
+            owner[next] = set->owner[t];
+            lvl->last[set->owner[t]] = next;
+            next++;
+        }
+    }
+    set->owner.swap(owner);
+    set->tree.assign(capacity + 1, 0);
+    for (uint32_t t = 0; t < next; t++) {
+        fenwick_add(set->tree, t, 1);
+    }
+    set->now = next;
+}
+
+void StackDistance::access(uint64_t addr) {
+    uint64_t block = addr >> b;
+    std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> found =
+        ids.insert(std::make_pair(block, (uint32_t)blocks.size()));
+    uint32_t id = found.first->second;
+    if (found.second) {
+        blocks.push_back(block);
+        for (size_t k = 0; k < levels.size(); k++) {
+            level *lvl = &levels[k];
+            std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> slot =
+                lvl->slots.insert(std::make_pair(block & ((1UL << k) - 1), (uint32_t)lvl->sets.size()));
+            if (slot.second) {
+                lvl->sets.push_back(set_stack());
+                lvl->sets.back().now = 0;
+                lvl->sets.back().live = 0;
+            }
+            lvl->set_of.push_back(slot.first->second);
+            lvl->last.push_back(NO_TIME);
+        }
+    }
+    num_accesses++;
+
+    for (size_t k = 0; k < levels.size(); k++) {
+        level *lvl = &levels[k];
+        set_stack *set = &lvl->sets[lvl->set_of[id]];
+        uint32_t prev = lvl->last[id];
+
+        if (prev == NO_TIME) {
+            // First touch: a compulsory miss at every size, counted as
+            // accesses - hits
+            set->live++;
+        } else {
+            uint32_t distance = set->live - fenwick_prefix(set->tree, prev);
+            lvl->bins[distance ? 64 - __builtin_clzll(distance) : 0]++;
+            fenwick_add(set->tree, prev, -1);
+            set->owner[prev] = NO_TIME;
+        }
+
+        if (set->now >= set->owner.size()) {
+            compact(lvl, set);
+        }
+        fenwick_add(set->tree, set->now, 1);
+        set->owner[set->now] = id;
+        lvl->last[id] = set->now;
+        set->now++;
+    }
+}
+
+void StackDistance::access_batch(const uint64_t *addrs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        access(addrs[i]);
+    }
+}
+
+uint64_t StackDistance::misses(uint64_t index_bits, uint64_t s) const {
+    const level &lvl = levels[index_bits];
+    uint64_t hits = 0;
+    for (uint64_t j = 0; j <= s && j < NUM_BINS; j++) {
+        hits += lvl.bins[j];
+    }
+    return num_accesses - hits;
+}
@@ -0,0 +1,64 @@
+#ifndef CACHESIM_STACKDIST_HPP
+#define CACHESIM_STACKDIST_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+// One-pass LRU stack-distance (Mattson) analysis at a fixed block size.
+// For every set count 2^k, k = 0 .. max_index_bits, it records how far down
+// its set's LRU stack each access finds its block. A cache with 2^k sets and
+// 2^s ways hits exactly when that distance is below 2^s, so one pass gives
+// the hit count of every (C,B,S) with C - B - S <= max_index_bits.
+//
+// Each set keeps a Fenwick tree over its own access times, with a mark at
+// the latest access time of every block in it; the distance of an access is
+// the number of marks after its block's previous one. That is O(log M) per
+// set count and access, M being the blocks live in the set. Sets are only
+// allocated once a block maps to them, so large set counts cost memory in
+// proportion to the blocks of the trace, not to 2^max_index_bits.
+class StackDistance
+{
+public:
+    StackDistance(uint64_t b, uint64_t max_index_bits);
+
+    void access(uint64_t addr);
+    void access_batch(const uint64_t *addrs, size_t n);
+
+    uint64_t accesses() const { return num_accesses; }
+    // Misses of an LRU cache with 2^index_bits sets of 2^s ways
+    uint64_t misses(uint64_t index_bits, uint64_t s) const;
+
+private:
+    // Distances are binned by bit length: bin 0 holds distance 0, bin j
+    // distances in [2^(j-1), 2^j), so hits(s) is the sum of bins 0..s
+    static const unsigned NUM_BINS = 65;
+
+    struct set_stack
+    {
+        std::vector<uint32_t> tree;  // Fenwick tree, 1-based over times
+        std::vector<uint32_t> owner; // block id marked at each time
+        uint32_t now;
+        uint32_t live;
+    };
+
+    struct level
+    {
+        std::vector<set_stack> sets;                  // touched sets only
+        std::unordered_map<uint64_t, uint32_t> slots; // set index -> position in sets
+        std::vector<uint32_t> set_of;                 // per block id: position of its set
+        std::vector<uint32_t> last;                   // per block id: time of the latest access
+        uint64_t bins[NUM_BINS];
+    };
+
+    void compact(level *lvl, set_stack *set);
+
+    uint64_t b;
+    uint64_t num_accesses;
+    std::unordered_map<uint64_t, uint32_t> ids; // block address -> block id
+    std::vector<uint64_t> blocks;               // block id -> block address
+    std::vector<level> levels;
+};
+
+#endif /* CACHESIM_STACKDIST_HPP */
@@ -0,0 +1,776 @@
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if defined(__SSE2__) && defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+#include "cachesim_trace.hpp"
+
+// Map a binary trace and check its header. Returns 1 if the file is not a
+// binary trace, -1 if it is one but is damaged.
+static int map_binary(const char *trace_fn, trace_reader_t *reader)
+{
+    int fd = open(trace_fn, O_RDONLY);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(trace_header_t))
+    {
+        close(fd);
+        return 1;
+    }
+
+    trace_header_t header;
+    if (pread(fd, &header, sizeof header, 0) != (ssize_t)sizeof header ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof TRACE_MAGIC))
+    {
+        close(fd);
+        return 1;
+    }
+
+    if (header.version != TRACE_VERSION || header.record_size != sizeof(uint64_t) ||
+        (uint64_t)st.st_size != sizeof header + header.num_records * sizeof(uint64_t))
+    {
+        printf("ERROR: %s: corrupt or unsupported binary trace\n", trace_fn);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("ERROR: can't map file %s\n", trace_fn);
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    reader->map = map;
+    reader->map_len = st.st_size;
+    reader->records = (const uint64_t *)((const char *)map + sizeof header);
+    reader->num_records = header.num_records;
+    return 0;
+}
+
+typedef enum trace_compression
+{
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+} trace_compression_t;
+
+// Where the bytes of a text trace come from: the file itself, a
+// decompression library reading it, or the pipe of an external gzip/zstd
+// process when cachesim was built without that library
+struct trace_source
+{
+    trace_compression_t compression;
+    int fd;
+    pid_t pid; // external decompressor, -1 if none
+#ifdef HAVE_ZLIB
+    gzFile gz;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+    std::vector<char> zstd_in;
+    ZSTD_inBuffer zstd_in_buf;
+    size_t zstd_ret;
+#endif
+};
+
+static trace_compression_t detect_compression(int fd)
+{
+    unsigned char magic[4];
+    ssize_t got = pread(fd, magic, sizeof magic, 0);
+    if (got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    {
+        return COMPRESSION_GZIP;
+    }
+    if (got == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+// Run "<command> -dc" with the trace on stdin and read its stdout instead
+static bool spawn_decompressor(trace_source *source, const char *command)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds))
+    {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        dup2(source->fd, STDIN_FILENO);
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        execlp(command, command, "-dc", (char *)NULL);
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+    close(source->fd);
+    source->fd = pipe_fds[0];
+    source->pid = pid;
+    return true;
+}
+
+static trace_source *open_source(const char *trace_fn)
+{
+    int fd = open(trace_fn, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("ERROR: can't open file %s\n", trace_fn);
+        fflush(stdout);
+        return NULL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    trace_source *source = new trace_source();
+    source->compression = detect_compression(fd);
+    source->fd = fd;
+    source->pid = -1;
+
+    bool ok = true;
+    if (source->compression == COMPRESSION_GZIP)
+    {
+#ifdef HAVE_ZLIB
+        source->gz = gzdopen(fd, "rb");
+        ok = source->gz != NULL;
+        if (ok)
+        {
+            source->fd = -1;
+            gzbuffer(source->gz, TRACE_TEXT_CHUNK);
+        }
+#else
+        ok = spawn_decompressor(source, "gzip");
+#endif
+    }
+    else if (source->compression == COMPRESSION_ZSTD)
+    {
+#ifdef HAVE_ZSTD
+        source->zstd = ZSTD_createDStream();
+        ok = source->zstd != NULL;
+        source->zstd_in.resize(ZSTD_DStreamInSize());
+        source->zstd_in_buf.src = source->zstd_in.data();
+        source->zstd_in_buf.size = 0;
+        source->zstd_in_buf.pos = 0;
+        source->zstd_ret = 0;
+#else
+        ok = spawn_decompressor(source, "zstd");
+#endif
+    }
+
+    if (!ok)
+    {
+        printf("ERROR: can't start decompressing %s\n", trace_fn);
+        close(fd);
+        delete source;
+        return NULL;
+    }
+    return source;
+}
+
+// Read up to len bytes of trace text. Returns 0 at the end of the trace and
+// -1 on error.
+static ssize_t read_source(trace_source *source, char *buf, size_t len)
+{
+#ifdef HAVE_ZLIB
+    if (source->compression == COMPRESSION_GZIP)
+    {
+        int got = gzread(source->gz, buf, len);
+        int err = Z_OK;
+        const char *msg = gzerror(source->gz, &err);
+        // zlib reports a truncated file as Z_BUF_ERROR without failing
+        if (got < 0 || (got == 0 && err == Z_BUF_ERROR))
+        {
+            printf("ERROR: gzip: %s\n", msg);
+            return -1;
+        }
+        return got;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (source->compression == COMPRESSION_ZSTD)
+    {
+        ZSTD_outBuffer out = {buf, len, 0};
+        while (out.pos == 0)
+        {
+            ZSTD_inBuffer *in = &source->zstd_in_buf;
+            if (in->pos == in->size)
+            {
+                ssize_t got = read(source->fd, source->zstd_in.data(), source->zstd_in.size());
+                if (got < 0)
+                {
+                    return -1;
+                }
+                if (got == 0)
+                {
+                    if (source->zstd_ret != 0)
+                    {
+                        printf("ERROR: zstd: truncated input\n");
+                        return -1;
+                    }
+                    return 0;
+                }
+                in->size = got;
+                in->pos = 0;
+            }
+            source->zstd_ret = ZSTD_decompressStream(source->zstd, &out, in);
+            if (ZSTD_isError(source->zstd_ret))
+            {
+                printf("ERROR: zstd: %s\n", ZSTD_getErrorName(source->zstd_ret));
+                return -1;
+            }
+        }
+        return out.pos;
+    }
+#endif
+
+    ssize_t got = read(source->fd, buf, len);
+    if (got == 0 && source->pid >= 0)
+    {
+        // The external decompressor only reports a damaged file through its
+        // exit status
+        int status;
+        waitpid(source->pid, &status, 0);
+        source->pid = -1;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("ERROR: decompressing the trace failed\n");
+            return -1;
+        }
+    }
+    return got;
+}
+
+static void close_source(trace_source *source)
+{
+#ifdef HAVE_ZLIB
+    if (source->compression == COMPRESSION_GZIP)
+    {
+        gzclose(source->gz);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (source->compression == COMPRESSION_ZSTD)
+    {
+        ZSTD_freeDStream(source->zstd);
+    }
+#endif
+    if (source->fd >= 0)
+    {
+        close(source->fd);
+    }
+    if (source->pid >= 0)
+    {
+        kill(source->pid, SIGTERM);
+        waitpid(source->pid, NULL, 0);
+    }
+    delete source;
+}
+
+// One batch of parsed records in the ring. A batch with count 0 ends the
+// trace; failed then tells whether it ended in an error.
+typedef struct trace_batch
+{
+    std::vector<uint64_t> addrs;
+    std::vector<uint8_t> rws;
+    size_t count;
+    bool failed;
+} trace_batch_t;
+
+// Bounded ring of batches between the decompression thread (producer) and
+// trace_next() (consumer). The consumer keeps the batch it is handing out
+// until its next call, so that slot stays full until then.
+struct trace_ring
+{
+    std::mutex lock;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    trace_batch_t batches[TRACE_RING_BATCHES];
+    size_t head;   // next batch to fill
+    size_t tail;   // next batch to consume
+    size_t filled; // batches published and not yet released
+    bool holding;  // consumer holds batches[tail]
+    size_t offset; // records of batches[tail] already handed out
+    bool closing;
+    std::thread thread;
+};
+
+static size_t parse_text(trace_reader_t *reader, uint64_t *addrs, uint8_t *rws, size_t max_records);
+
+static void decompress_thread(trace_reader_t *reader)
+{
+    trace_ring *ring = reader->ring;
+    for (;;)
+    {
+        trace_batch_t *batch;
+        {
+            std::unique_lock<std::mutex> guard(ring->lock);
+            ring->not_full.wait(guard, [ring] { return ring->filled < TRACE_RING_BATCHES || ring->closing; });
+            if (ring->closing)
+            {
+                return;
+            }
+            batch = &ring->batches[ring->head];
+        }
+
+        batch->count = parse_text(reader, batch->addrs.data(), batch->rws.data(), TRACE_CHUNK);
+        batch->failed = reader->text.failed;
+
+        {
+            std::lock_guard<std::mutex> guard(ring->lock);
+            ring->head = (ring->head + 1) % TRACE_RING_BATCHES;
+            ring->filled++;
+        }
+        ring->not_empty.notify_one();
+        if (batch->count == 0)
+        {
+            return;
+        }
+    }
+}
+
+// Hand out records from the ring, waiting for the next batch as needed
+static size_t next_from_ring(trace_reader_t *reader, const uint64_t **addrs, const uint8_t **rws,
+                             size_t max_records)
+{
+    trace_ring *ring = reader->ring;
+    std::unique_lock<std::mutex> guard(ring->lock);
+
+    if (ring->holding && ring->offset == ring->batches[ring->tail].count)
+    {
+        if (ring->offset == 0)
+        {
+            // The end-of-trace batch stays put
+            return 0;
+        }
+        ring->holding = false;
+        ring->tail = (ring->tail + 1) % TRACE_RING_BATCHES;
+        ring->filled--;
+        ring->not_full.notify_one();
+    }
+    if (!ring->holding)
+    {
+        ring->not_empty.wait(guard, [ring] { return ring->filled > 0; });
+        ring->holding = true;
+        ring->offset = 0;
+    }
+
+    trace_batch_t *batch = &ring->batches[ring->tail];
+    if (batch->count == 0)
+    {
+        reader->failed = batch->failed;
+        return 0;
+    }
+    size_t count = std::min(max_records, batch->count - ring->offset);
+    *addrs = batch->addrs.data() + ring->offset;
+    *rws = batch->rws.data() + ring->offset;
+    ring->offset += count;
+    return count;
+}
+
+/**
+ * Open a text or binary trace for reading. The format and compression are
+ * detected from the file contents. Returns 0 on success.
+ */
+int trace_open(const char *trace_fn, trace_reader_t *reader)
+{
+    reader->name = trace_fn;
+    reader->source = NULL;
+    reader->ring = NULL;
+    reader->text.pos = 0;
+    reader->text.len = 0;
+    reader->text.eof = false;
+    reader->text.line = 0;
+    reader->text.failed = false;
+    reader->records = NULL;
+    reader->num_records = 0;
+    reader->next = 0;
+    reader->map = NULL;
+    reader->map_len = 0;
+    reader->failed = false;
+
+    int ret = map_binary(trace_fn, reader);
+    if (ret == 0)
+    {
+        reader->addrs.resize(TRACE_CHUNK);
+        reader->rws.resize(TRACE_CHUNK);
+        return 0;
+    }
+    if (ret < 0)
+    {
+        return 1;
+    }
+
+    reader->source = open_source(trace_fn);
+    if (!reader->source)
+    {
+        return 1;
+    }
+    reader->text.data.resize(TRACE_TEXT_CHUNK);
+
+    if (reader->source->compression == COMPRESSION_NONE)
+    {
+        reader->addrs.resize(TRACE_CHUNK);
+        reader->rws.resize(TRACE_CHUNK);
+        return 0;
+    }
+
+    trace_ring *ring = new trace_ring();
+    for (size_t i = 0; i < TRACE_RING_BATCHES; i++)
+    {
+        ring->batches[i].addrs.resize(TRACE_CHUNK);
+        ring->batches[i].rws.resize(TRACE_CHUNK);
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->filled = 0;
+    ring->holding = false;
+    ring->offset = 0;
+    ring->closing = false;
+    reader->ring = ring;
+    ring->thread = std::thread(decompress_thread, reader);
+    return 0;
+}
+
+// Value of one hex digit, or 0xFF if c is not one
+static inline unsigned hex_nibble(unsigned char c)
+{
+    unsigned digit = c - '0';
+    unsigned alpha = (c | 0x20) - 'a';
+    return digit < 10 ? digit : (alpha < 6 ? alpha + 10 : 0xFF);
+}
+
+// Decode exactly 16 hex digits. Returns false if any of them is not a hex
+// digit.
+static inline bool decode_hex16(const char *p, uint64_t *value)
+{
+#if defined(__SSE2__) && defined(__x86_64__)
+    // Classify and convert all 16 digits at once: each byte becomes its
+    // nibble value, pairs of nibbles are merged into bytes and the 8 bytes
+    // (most significant first) are byte-swapped into place.
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+    if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+    {
+        return false;
+    }
+    __m128i nibbles = _mm_add_epi8(_mm_and_si128(lower, _mm_set1_epi8(0x0F)),
+                                   _mm_and_si128(alpha, _mm_set1_epi8(9)));
+    __m128i bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4),
+                                 _mm_srli_epi16(nibbles, 8));
+    __m128i packed = _mm_packus_epi16(bytes, bytes);
+    *value = __builtin_bswap64((uint64_t)_mm_cvtsi128_si64(packed));
+    return true;
+#else
+    uint64_t result = 0;
+    unsigned bad = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        unsigned nibble = hex_nibble(p[i]);
+        bad |= nibble;
+        result = (result << 4) | (nibble & 0xF);
+    }
+    *value = result;
+    return !(bad & 0xF0);
+#endif
+}
+
+// Parse one line in the canonical "R 0x<16 hex digits>\n" layout
+static inline bool parse_fixed_line(const char *p, uint64_t *addr, uint8_t *rw)
+{
+    if ((p[0] != 'R' && p[0] != 'W' && p[0] != 'I') || p[1] != ' ' || p[2] != '0' || p[3] != 'x' || p[20] != '\n' ||
+        !decode_hex16(p + 4, addr))
+    {
+        return false;
+    }
+    *rw = p[0];
+    return true;
+}
+
+// Parse any other line: "<R|W|I> 0x<1 to 16 hex digits>", with extra blanks
+// allowed. Returns 1 for a record, 0 for a blank line and -1 if malformed.
+static int parse_line(const char *p, const char *end, uint64_t *addr, uint8_t *rw_out)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    {
+        p++;
+    }
+    if (p == end)
+    {
+        return 0;
+    }
+
+    char rw = *p++;
+    if ((rw != 'R' && rw != 'W' && rw != 'I') || p == end || (*p != ' ' && *p != '\t'))
+    {
+        return -1;
+    }
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        p++;
+    }
+    if (end - p < 3 || p[0] != '0' || (p[1] | 0x20) != 'x')
+    {
+        return -1;
+    }
+    p += 2;
+
+    uint64_t address = 0;
+    int digits = 0;
+    unsigned nibble;
+    while (p < end && (nibble = hex_nibble(*p)) != 0xFF)
+    {
+        if (++digits > 16)
+        {
+            return -1;
+        }
+        address = (address << 4) | nibble;
+        p++;
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    {
+        p++;
+    }
+    if (!digits || p != end)
+    {
+        return -1;
+    }
+    *addr = address;
+    *rw_out = rw;
+    return 1;
+}
+
+// Move the unparsed tail of the text buffer to its front and read more
+// behind it. Returns false on a read error or a line longer than the buffer.
+static bool refill_text(trace_reader_t *reader)
+{
+    trace_text_t *text = &reader->text;
+    size_t left = text->len - text->pos;
+    if (left == text->data.size())
+    {
+        printf("ERROR: %s:%" PRIu64 ": line too long\n", reader->name.c_str(), text->line + 1);
+        return false;
+    }
+    memmove(text->data.data(), text->data.data() + text->pos, left);
+    text->pos = 0;
+    text->len = left;
+
+    ssize_t got = read_source(reader->source, text->data.data() + left, text->data.size() - left);
+    if (got < 0)
+    {
+        printf("ERROR: can't read file %s\n", reader->name.c_str());
+        return false;
+    }
+    if (got == 0)
+    {
+        text->eof = true;
+    }
+    text->len += got;
+    return true;
+}
+
+// Parse up to max_records text records into addrs and rws. Errors set
+// text.failed, not reader->failed, since this may run on the decompression
+// thread.
+static size_t parse_text(trace_reader_t *reader, uint64_t *addrs, uint8_t *rws, size_t max_records)
+{
+    trace_text_t *text = &reader->text;
+    size_t count = 0;
+
+    while (count < max_records)
+    {
+        const char *p = text->data.data() + text->pos;
+        const char *end = text->data.data() + text->len;
+
+        // Nearly every line has the canonical fixed layout
+        if (end - p >= 21 && parse_fixed_line(p, &addrs[count], &rws[count]))
+        {
+            count++;
+            text->pos += 21;
+            text->line++;
+            continue;
+        }
+
+        const char *newline = (const char *)memchr(p, '\n', end - p);
+        if (!newline && !text->eof)
+        {
+            if (!refill_text(reader))
+            {
+                text->failed = true;
+                return 0;
+            }
+            continue;
+        }
+        if (p == end)
+        {
+            break;
+        }
+
+        const char *line_end = newline ? newline : end;
+        text->line++;
+        int ret = parse_line(p, line_end, &addrs[count], &rws[count]);
+        if (ret < 0)
+        {
+            printf("ERROR: %s:%" PRIu64 ": malformed trace record `%.*s'\n",
+                   reader->name.c_str(), text->line, (int)std::min<ptrdiff_t>(line_end - p, 64), p);
+            text->failed = true;
+            return 0;
+        }
+        count += ret;
+        text->pos = (newline ? newline + 1 : end) - text->data.data();
+    }
+    return count;
+}
+
+// Unpack up to max_records binary records, TRACE_UNPACK_CHUNK at most, into
+// the reader's arrays. A record with both type bits set is corrupt.
+static size_t unpack_binary(trace_reader_t *reader, size_t max_records)
+{
+    uint64_t left = reader->num_records - reader->next;
+    size_t count = std::min((uint64_t)std::min(max_records, TRACE_UNPACK_CHUNK), left);
+    const uint64_t *records = reader->records + reader->next;
+    uint64_t bad = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t record = records[i];
+        bad |= (record & TRACE_TYPE_BITS) == TRACE_TYPE_BITS;
+        reader->addrs[i] = trace_addr(record);
+        reader->rws[i] = trace_rw(record);
+    }
+    if (bad)
+    {
+        printf("ERROR: %s: corrupt or unsupported binary trace\n", reader->name.c_str());
+        reader->failed = true;
+        return 0;
+    }
+    reader->next += count;
+    return count;
+}
+
+/**
+ * Hand out up to max_records more records of the trace: addresses through
+ * *addrs and 'R', 'W' or 'I' through *rws. Returns 0 at the end of the
+ * trace or on error (reader->failed is then set).
+ */
+size_t trace_next(trace_reader_t *reader, const uint64_t **addrs, const uint8_t **rws, size_t max_records)
+{
+    if (reader->ring)
+    {
+        return next_from_ring(reader, addrs, rws, max_records);
+    }
+
+    if (reader->addrs.size() < max_records)
+    {
+        reader->addrs.resize(max_records);
+        reader->rws.resize(max_records);
+    }
+    *addrs = reader->addrs.data();
+    *rws = reader->rws.data();
+    if (!reader->source)
+    {
+        return unpack_binary(reader, max_records);
+    }
+
+    size_t count = parse_text(reader, reader->addrs.data(), reader->rws.data(), max_records);
+    reader->failed = reader->text.failed;
+    return count;
+}
+
+// Skip up to n records, e.g. those a checkpoint has already seen. Returns
+// how many were skipped.
+uint64_t trace_skip(trace_reader_t *reader, uint64_t n)
+{
+    uint64_t skipped = 0;
+    const uint64_t *addrs;
+    const uint8_t *rws;
+    size_t count;
+    if (!reader->source)
+    {
+        skipped = std::min(n, reader->num_records - reader->next);
+        reader->next += skipped;
+        return skipped;
+    }
+    while (skipped < n && (count = trace_next(reader, &addrs, &rws, std::min(n - skipped, (uint64_t)TRACE_CHUNK))))
+    {
+        skipped += count;
+    }
+    return skipped;
+}
+
+void trace_close(trace_reader_t *reader)
+{
+    if (reader->ring)
+    {
+        {
+            std::lock_guard<std::mutex> guard(reader->ring->lock);
+            reader->ring->closing = true;
+        }
+        reader->ring->not_full.notify_one();
+        reader->ring->thread.join();
+        delete reader->ring;
+        reader->ring = NULL;
+    }
+    if (reader->source)
+    {
+        close_source(reader->source);
+        reader->source = NULL;
+    }
+    if (reader->map)
+    {
+        munmap(reader->map, reader->map_len);
+        reader->map = NULL;
+    }
+    reader->addrs.clear();
+    reader->rws.clear();
+    reader->text.data.clear();
+}
+
+/**
+ * Write the header of a binary trace holding num_records records, which
+ * follow it as an array of trace_pack()ed values. Returns 0 on success.
+ */
+int trace_write_header(FILE *out, uint64_t num_records)
+{
+    trace_header_t header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, TRACE_MAGIC, sizeof TRACE_MAGIC);
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(uint64_t);
+    header.num_records = num_records;
+
+    return fwrite(&header, sizeof header, 1, out) == 1 ? 0 : 1;
+}
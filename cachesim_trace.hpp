@@ -0,0 +1,107 @@
+#ifndef CACHESIM_TRACE_HPP
+#define CACHESIM_TRACE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Binary ("packed") traces start with this header, followed by
+// num_records little-endian 64-bit records. Each record is the accessed
+// address with TRACE_WRITE_BIT set for stores and TRACE_FETCH_BIT for
+// instruction fetches. Converted with cachesim-convert.
+typedef struct trace_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t num_records;
+    uint64_t reserved;
+} trace_header_t;
+
+static const char TRACE_MAGIC[8] = {'C', 'S', 'T', 'R', 'A', 'C', 'E', '\0'};
+static const uint32_t TRACE_VERSION = 1;
+// Binary addresses must leave the top two bits free; they hold the record
+// type. Text traces have no such limit.
+static const uint64_t TRACE_WRITE_BIT = 1ULL << 63;
+static const uint64_t TRACE_FETCH_BIT = 1ULL << 62;
+static const uint64_t TRACE_TYPE_BITS = TRACE_WRITE_BIT | TRACE_FETCH_BIT;
+// Number of records handed out per trace_next() call by default
+static const size_t TRACE_CHUNK = 1 << 16;
+// Binary records unpacked per trace_next() call at most, few enough for the
+// unpacked arrays to stay in cache until the simulator reads them
+static const size_t TRACE_UNPACK_CHUNK = 4096;
+// Bytes of a text trace read at a time; also the longest accepted line
+static const size_t TRACE_TEXT_CHUNK = 1 << 20;
+// Batches of TRACE_CHUNK records buffered between the decompression thread
+// and the simulator
+static const size_t TRACE_RING_BATCHES = 8;
+
+static inline uint64_t trace_pack(char rw, uint64_t addr)
+{
+    if (rw == 'W')
+    {
+        return addr | TRACE_WRITE_BIT;
+    }
+    return rw == 'I' ? (addr | TRACE_FETCH_BIT) : addr;
+}
+
+static inline char trace_rw(uint64_t record)
+{
+    if (record & TRACE_WRITE_BIT)
+    {
+        return 'W';
+    }
+    return (record & TRACE_FETCH_BIT) ? 'I' : 'R';
+}
+
+static inline uint64_t trace_addr(uint64_t record)
+{
+    return record & ~TRACE_TYPE_BITS;
+}
+
+struct trace_source;
+struct trace_ring;
+
+// Parse state of a text trace. With a decompression thread, only that
+// thread touches it, and errors reach the reader through the ring.
+typedef struct trace_text
+{
+    std::vector<char> data;
+    size_t pos;
+    size_t len;
+    bool eof;
+    uint64_t line;
+    bool failed;
+} trace_text_t;
+
+// Sequential reader over a text or binary trace, handing out records as an
+// address array and a parallel array of 'R', 'W' or 'I'. Binary traces are
+// mapped whole and unpacked a chunk at a time; text traces are read in large
+// chunks and parsed straight into the arrays. Compressed (gzip or zstd) text
+// traces are decompressed and parsed on a separate thread, which hands
+// batches of records over through a bounded ring.
+typedef struct trace_reader
+{
+    std::string name;
+    trace_source *source; // text bytes, NULL for binary traces
+    trace_ring *ring;     // batches from the decompression thread, if any
+    trace_text_t text;
+    std::vector<uint64_t> addrs; // records handed out by trace_next()
+    std::vector<uint8_t> rws;
+    const uint64_t *records; // whole mapped trace, binary only
+    uint64_t num_records;
+    uint64_t next;
+    void *map;
+    size_t map_len;
+    bool failed; // the trace ended in an error, set by trace_next()
+} trace_reader_t;
+
+int trace_open(const char *trace_fn, trace_reader_t *reader);
+size_t trace_next(trace_reader_t *reader, const uint64_t **addrs, const uint8_t **rws, size_t max_records);
+uint64_t trace_skip(trace_reader_t *reader, uint64_t n);
+void trace_close(trace_reader_t *reader);
+int trace_write_header(FILE *out, uint64_t num_records);
+
+#endif /* CACHESIM_TRACE_HPP */